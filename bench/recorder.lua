@@ -0,0 +1,47 @@
+--[[
+Measures the overhead of the execution recorder.
+
+Build the debugger as robert/debugger.dll next to this script and run:
+    echo r | lua bench/recorder.lua
+The 'r' answers the prompt the debugger shows when it is loaded.
+]]
+
+local debugger = require "robert.debugger"
+
+local N = tonumber(arg and arg[1]) or 1000000
+
+local function simulate(n)
+    local x, v, label = 0, 1, ""
+    for i = 1, n do
+        x = x + v
+        if x > 100 or x < -100 then
+            v = -v
+        end
+        if i % 1000 == 0 then
+            label = "step " .. i
+        end
+    end
+    return x, label
+end
+
+local function measure(title)
+    local t = os.clock()
+    simulate(N)
+    t = os.clock() - t
+    print(string.format("%-28s %8.3f s  %8.1f ns/iteration", title, t, t * 1e9 / N))
+end
+
+measure("no recording")
+
+debugger.record("nothing-matches")
+measure("recording, filtered out")
+local _, _, ns = debugger.recordStats()
+print(string.format("%-28s %8.1f ns/line event", "  recorder time", ns))
+
+debugger.record("simulate")
+measure("recording simulate()")
+local kept, dropped, ns = debugger.recordStats()
+print(string.format("%-28s %8.1f ns/line event, %d events kept, %d dropped",
+    "  recorder time", ns, kept, dropped))
+
+debugger.record(false)
@@ -21,16 +21,29 @@
 * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 ******************************************************************************/
 
+#ifndef _WIN32
+#define _XOPEN_SOURCE 700
+#endif
+
 #include <lua.h>
 #include <lauxlib.h>
 #include <stdio.h>
-#include <io.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <stdarg.h>
 #include <assert.h>
+#ifdef _WIN32
+#include <io.h>
 #include <Windows.h>
+#else
+#include <limits.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#endif
 
+#ifdef _WIN32
 /*
 ** Compile command:
 ** cl debugger.c /LD /MD /EHs /O2
@@ -42,10 +55,105 @@ static WORD g_TxtAttr;
 
 #define ChangeTextColor() SetConsoleTextAttribute(g_hStdOut, FOREGROUND_GREEN | FOREGROUND_INTENSITY)
 #define RestoreTextColor() SetConsoleTextAttribute(g_hStdOut, g_TxtAttr)
+#define DEBUGGER_API __declspec(dllexport)
+#else
+/*
+** Compile command:
+** gcc debugger.c -shared -fPIC -O2 -I/usr/include/lua5.1 -o robert/debugger.so
+**
+** The few Windows calls used are mapped onto POSIX ones. There is no console
+** color.
+*/
+#define PATH_CASE_SENSITIVE
+#define _MAX_PATH PATH_MAX
+#define _stricmp strcasecmp
+#define _strnicmp strncasecmp
+#define _access access
+#define _fullpath(buf, path, size) realpath(path, buf)
+
+typedef long long LONGLONG;
+typedef unsigned long DWORD;
+typedef union { LONGLONG QuadPart; } LARGE_INTEGER;
+
+static int QueryPerformanceCounter(LARGE_INTEGER * t)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    t->QuadPart = (LONGLONG)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    return 1;
+}
+
+static int QueryPerformanceFrequency(LARGE_INTEGER * freq)
+{
+    freq->QuadPart = 1000000000;
+    return 1;
+}
+
+static DWORD GetTickCount()
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return (DWORD)(t.QuadPart / 1000000);
+}
+
+#define ChangeTextColor()
+#define RestoreTextColor()
+#define DEBUGGER_API
+#endif
 
-static const luaL_Reg entries[] = { 0 };
+/*
+** Where command output goes: stdout, or the output file of a batch script.
+*/
+static FILE * g_out;
 
 static void hook(lua_State *L, lua_Debug *ar);
+static void loadScript(lua_State * L, const char * script, const char * output);
+
+/*
+** Non-blocking API for hosts running scripts as coroutines. With async mode
+** on, a stop inside a coroutine yields it back to the host instead of
+** blocking in prompt(); the host then sees coroutine.resume return with
+** status(co) == "debug-paused", feeds commands with post() and drives them
+** with poll() from its event loop. poll() returns "resumed" once a step,
+** over, finish or run command has been taken, after which the host resumes
+** the coroutine as usual. Step commands only apply to the thread they were
+** given to, so the host and other coroutines keep running meanwhile, only
+** stopping at breakpoints.
+** Only a coroutine stopped directly in its own Lua code can be suspended;
+** Lua 5.1 refuses to yield across pcall or a metamethod, so a stop below
+** such a C boundary falls back to the blocking prompt (see canYield()).
+*/
+static int apiSetAsync(lua_State * L);
+static int apiStatus(lua_State * L);
+static int apiPost(lua_State * L);
+static int apiPoll(lua_State * L);
+static int apiRecord(lua_State * L);
+static int apiRecordStats(lua_State * L);
+static int apiRunScript(lua_State * L);
+
+static const luaL_Reg entries[] = {
+    { "setAsync", apiSetAsync },
+    { "status", apiStatus },
+    { "post", apiPost },
+    { "poll", apiPoll },
+    { "record", apiRecord },
+    { "recordStats", apiRecordStats },
+    { "runScript", apiRunScript },
+    { NULL, NULL }
+};
+
+/*
+** Set while poll() runs commands on a paused coroutine, so that code run by
+** 'exec' or table sorting doesn't re-enter the debugger through the hook.
+*/
+static int g_inCommand;
+
+/*
+** Number of threads put in the "resuming" table, see resumedEvent(). A thread
+** collected before it runs again leaves it too high, which only costs a
+** lookup per line event.
+*/
+static int g_resuming;
 
 enum CMD
 {
@@ -55,12 +163,80 @@ enum CMD
     RUN
 };
 
-__declspec(dllexport) int luaopen_robert_debugger(lua_State * L)
+/*
+** Commands that don't resume the debuggee.
+*/
+enum OP
+{
+    OP_LISTLOCALS = RUN + 1,
+    OP_LISTUPVARS,
+    OP_PRINTSTACK,
+    OP_WATCH,
+    OP_EXEC,
+    OP_SETBREAKPOINT,
+    OP_DELBREAKPOINT,
+    OP_SETFUNCBREAKPOINT,
+    OP_DELFUNCBREAKPOINT,
+    OP_LISTBREAKPOINTS,
+    OP_RECORD,
+    OP_BACK,
+    OP_REWIND,
+    OP_HISTORY,
+    OP_PROFILE,
+    OP_HEATMAP,
+    OP_SET,
+    OP_HELP
+};
+
+#define ACTION_ARGS 4
+
+/*
+** A command line compiled once: the command, its arguments split and
+** converted by strtol, and the text after the command name for 'exec'.
+** Batch scripts keep lists of them linked through next, so a breakpoint hit
+** many times never parses its commands again. The strings live in the same
+** allocation, right after the struct.
+*/
+typedef struct Action {
+    int op;
+    int argc;
+    const char * argv[ACTION_ARGS];
+    long num[ACTION_ARGS];
+    const char * rest;
+    struct Action * next;
+} Action;
+
+/*
+** Batch mode. A command script, named by the LUA_DEBUGGER_SCRIPT environment
+** variable or passed to debugger.runScript(), is compiled when loaded. Its
+** plain commands run right away, "on <file> <line> <command>" sets a
+** breakpoint and attaches an action to it, and "onstop <command>" adds an
+** action for stops that have none of their own. At a stop the actions run
+** instead of the prompt, then the debuggee runs on unless an action resumed
+** it otherwise. Output goes to LUA_DEBUGGER_OUTPUT if given.
+*/
+typedef struct BatchStop {
+    char path[_MAX_PATH + 1];
+    int line;
+    Action * actions;
+    struct BatchStop * next;
+} BatchStop;
+
+static struct {
+    int on;
+    BatchStop * stops;
+    Action * onstop;
+} g_batch;
+
+DEBUGGER_API int luaopen_robert_debugger(lua_State * L)
 {
+#ifdef _WIN32
     CONSOLE_SCREEN_BUFFER_INFO bi;
     g_hStdOut = GetStdHandle(STD_OUTPUT_HANDLE);
     GetConsoleScreenBufferInfo(g_hStdOut, &bi);
     g_TxtAttr = bi.wAttributes;
+#endif
+    g_out = stdout;
 
     lua_pushliteral(L, "debugger");
     lua_newtable(L);
@@ -70,690 +246,2838 @@ __declspec(dllexport) int luaopen_robert_debugger(lua_State * L)
     lua_pushliteral(L, "cmd");
     lua_pushinteger(L, STEP);
     lua_rawset(L, -3);
+    lua_pushliteral(L, "stepthread");
+    lua_pushthread(L);
+    lua_rawset(L, -3);
     lua_pushliteral(L, "stacklevel");
     lua_pushinteger(L, 0);
     lua_rawset(L, -3);
+    lua_pushliteral(L, "async");
+    lua_pushboolean(L, 0);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "paused");
+    lua_newtable(L);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "resuming");
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushliteral(L, "__mode");
+    lua_pushliteral(L, "k");
+    lua_rawset(L, -3);
+    lua_setmetatable(L, -2);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "funcbreakpoints");
+    lua_newtable(L);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "heatsources");
+    lua_newtable(L);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "paths");
+    lua_newtable(L);
+    lua_rawset(L, -3);
     lua_rawset(L, LUA_REGISTRYINDEX);
 
     luaL_register(L, "robert.debugger", entries);
     lua_sethook(L, hook, LUA_MASKLINE | LUA_MASKCALL | LUA_MASKRET, 0);
+
+    if (getenv("LUA_DEBUGGER_SCRIPT"))
+        loadScript(L, getenv("LUA_DEBUGGER_SCRIPT"), getenv("LUA_DEBUGGER_OUTPUT"));
     return 1;
 }
 
-static void prompt(lua_State *L, lua_Debug * ar);
-static void checkBreakPoint(lua_State *L, lua_Debug * ar);
-
-void hook(lua_State * L, lua_Debug * ar)
+/*
+** Get the full path of file into path, lower-cased unless paths are case
+** sensitive. Return 0 if it can't be resolved.
+*/
+static int fullPath(const char * file, char * path)
 {
-    int event = ar->event;
-    int top = lua_gettop(L);
-
-    lua_pushliteral(L, "debugger");
-    lua_rawget(L, LUA_REGISTRYINDEX);
-
-    if (event == LUA_HOOKLINE) {
-        int cmd;
-
-        lua_pushliteral(L, "cmd");
-        lua_rawget(L, -2);
-        cmd = lua_tointeger(L, -1);
-        lua_pop(L, 1);
-
-        if (cmd == STEP) {
-            lua_pushliteral(L, "stacklevel");
-            lua_pushinteger(L, 0);
-            lua_rawset(L, -3);
-            prompt(L, ar);
-        }
-        else if (cmd == OVER) {
-            int level;
-
-            lua_pushliteral(L, "stacklevel");
-            lua_rawget(L, -2);
-            level = lua_tointeger(L, -1);
-            lua_pop(L, 1);
-            if (!level)
-                prompt(L, ar);
-            else
-                checkBreakPoint(L, ar);
-        }
-        else if (cmd == FINISH) {
-            //prompt(L, ar);
-        }
-        else if (cmd == RUN) {
-            checkBreakPoint(L, ar);
-        }
-    }
-    else {
-        int level;
-        assert(event != LUA_HOOKCOUNT);
-
-        lua_pushliteral(L, "stacklevel");
-        lua_rawget(L, -2);
-        level = lua_tointeger(L, -1);
-        lua_pop(L, 1);
-
-        if (event == LUA_HOOKCALL) {
-            level++;
-        }
-        else if (event == LUA_HOOKRET || event == LUA_HOOKTAILRET) {
-            if (level)
-                level--;
-        }
-        lua_pushliteral(L, "stacklevel");
-        lua_pushinteger(L, level);
-        lua_rawset(L, -3);
-    }
-    lua_pop(L, 1);
-    assert(top == lua_gettop(L));
+    if (!_fullpath(path, file, _MAX_PATH))
+        return 0;
+#ifndef PATH_CASE_SENSITIVE
+    _strlwr(path);
+#endif
+    return 1;
 }
 
 /*
-** Check if the current line contains a breakpoint. If yes, break and prompt
-** for user, and reset statck level to 0 preparing for the next "OVER" command.
-** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
-** unchanged after call, but the "debugger" table may be changed.
+** Push the full path of the file the function at ar was loaded from, or
+** false if it wasn't loaded from a file. Resolving a path may cost several
+** syscalls, so paths are cached in the "paths" table keyed by the source
+** string, and breakpoint checks on every line look them up there.
+** ar has been filled by "S". On top of L is the "debugger" table stored in
+** LUA_REGISTRYINDEX. L increases by 1.
 */
-void checkBreakPoint(lua_State *L, lua_Debug * ar)
+static void pushChunkPath(lua_State * L, lua_Debug * ar)
 {
-    int breakpoint;
     char path[_MAX_PATH + 1];
 
-    lua_getinfo(L, "Sl", ar);
-    _fullpath(path, ar->short_src, _MAX_PATH);
-#ifndef PATH_CASE_SENSITIVE
-    _strlwr(path);
-#endif
-
-    lua_pushliteral(L, "breakpoints");
+    if (*ar->source != '@') { //don't cache the code of every loadstring()
+        lua_pushboolean(L, 0);
+        return;
+    }
+    lua_pushliteral(L, "paths");
     lua_rawget(L, -2);
-    lua_pushstring(L, path);
+    lua_pushstring(L, ar->source);
     lua_rawget(L, -2);
-    if (lua_istable(L, -1)) {
-        lua_rawgeti(L, -1, ar->currentline);
-        breakpoint = lua_isnil(L, -1) ? 0 : 1;
+    if (lua_isnil(L, -1)) {
         lua_pop(L, 1);
+        if (fullPath(ar->source + 1, path))
+            lua_pushstring(L, path);
+        else
+            lua_pushboolean(L, 0);
+        lua_pushstring(L, ar->source);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, -4);
     }
-    else
-        breakpoint = 0;
-    lua_pop(L, 2);
-
-    if (breakpoint) {
-        lua_pushliteral(L, "stacklevel");
-        lua_pushinteger(L, 0);
-        lua_rawset(L, -3);
-        prompt(L, ar);
-    }
+    lua_remove(L, -2);
 }
 
-static char * parseOneArg(char * begin, char * end, char ** endPtr);
-static void watch(lua_State * L, lua_Debug * ar, char * argBegin, char * argEnd);
-static void exec(lua_State * L, lua_Debug * ar, char * argBegin, char * argEnd);
-static void listLocals(lua_State * L, lua_Debug * ar, char * argBegin, char * argEnd);
-static void listUpVars(lua_State * L, lua_Debug * ar, char * argBegin, char * argEnd);
-static void printStack(lua_State * L);
-static void setBreakPoint(lua_State * L, const char * src, char * argBegin,
-    char * argEnd, int del);
-static void listBreakPoints(lua_State * L);
-static void showHelp();
-
-#define CMD_LINE 1024
-
 /*
-** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
-** unchanged after call, but the "debugger" table may be changed.
+** Execution recorder. For functions whose name or source matches a filter,
+** every line event is logged together with the locals changed since the
+** previous event. Changes are found by comparing against a native shadow
+** copy of the frame's locals, and the log lives in a fixed-size circular
+** arena where the oldest events are dropped to make room for new ones, so
+** memory use never exceeds the arena size.
+**
+** Each event is one variable-length record: a RecEvent header followed by
+** nvals value entries, each being slot, type, name length, name and a type
+** dependent payload. A full snapshot of the locals is logged whenever the
+** frame changes, so locals at any event can be rebuilt by scanning forward
+** from the oldest event kept.
 */
-void prompt(lua_State * L, lua_Debug * ar)
-{
-    int cmd;
-    int top = lua_gettop(L);
-
-    ChangeTextColor();
-
-    lua_getinfo(L, "nSl", ar);
-    printf("%s \tLine:%d \tName:%s \tWhat:%s\n", ar->short_src, ar->currentline,
-        ar->name ? ar->name : "(N/A)", *ar->what ? ar->what : "(N/A)");
+#define REC_ARENA_KB 256
+#define REC_MAX_FUNCS 256
+#define REC_MAX_SLOTS 255
+#define REC_NAME_LEN 31
+#define REC_FILTER_LEN 256
+#define REC_STR_PREFIX 32
+#define REC_MAX_ENTRY (3 + REC_NAME_LEN + 4 + 1 + REC_STR_PREFIX)
+
+#define REC_FULL 1
+
+typedef struct RecEvent {
+    unsigned short size;
+    unsigned char flags;
+    unsigned char nvals;
+    unsigned short fid;
+    unsigned char nslots;
+    unsigned char reserved;
+    int line;
+    unsigned long seq;
+} RecEvent;
 
-    while (1) {
-        char buf[CMD_LINE];
-        char * end;
-        char * p;
-        char * pCmd;
+typedef struct RecFunc {
+    char src[LUA_IDSIZE];
+    int linedefined;
+    char name[REC_NAME_LEN + 1];
+} RecFunc;
 
-        printf("?>");
-        fgets(buf, CMD_LINE, stdin);
-        end = buf + strlen(buf);
-        pCmd = parseOneArg(buf, end, &p);
+/*
+** A shadowed local. Values behind p are anchored in the "recshadow" table,
+** so that the collector can't free them and hand their address to a new
+** object while the shadow still compares against it.
+*/
+typedef struct RecSlot {
+    const char * name;
+    int type;
+    const void * p;     //table, function, userdata, thread or interned string
+    lua_Number n;
+    size_t len;
+} RecSlot;
+
+static struct {
+    unsigned char * arena;  //NULL when not recording
+    size_t cap;
+    size_t head;            //oldest event
+    size_t tail;            //where the next event goes
+    size_t wrap;            //end of the data before tail wrapped to 0
+    int wrapped;
+    unsigned long count;    //events kept
+    unsigned long seq;      //sequence number of the newest event
+    unsigned long evicted;
+    unsigned long cursor;   //event shown by 'back' and 'rewind'
+    char filter[REC_FILTER_LEN];
+    RecFunc funcs[REC_MAX_FUNCS];
+    int nfuncs;
+    int funcsFull;          //a function has been left out for lack of slots
+    lua_State * frameL;     //thread of the activation frameFid belongs to
+    int frameFid;           //function id of the running activation, -1 if not recorded
+    lua_State * shadowL;    //thread of the shadowed frame, NULL if invalid
+    int shadowFid;
+    int shadowDepth;        //calls made by the shadowed frame still running
+    int shadowCount;
+    RecSlot shadow[REC_MAX_SLOTS + 1];
+    unsigned long lines;    //line events seen while recording
+    LONGLONG ticks;         //time spent in recordLine()
+} g_rec;
 
-        if (!pCmd) { //an empty line
-            printf("Invalid command!\n");
-            continue;
-        }
-        p++;
+/*
+** Match s against a pattern where '*' matches any sequence of characters and
+** '?' matches any single character.
+*/
+static int matchGlob(const char * pattern, const char * s)
+{
+    const char * star = NULL;
+    const char * back = NULL;
 
-        if (!_stricmp(pCmd, "s") || !_stricmp(pCmd, "step")) {
-            cmd = STEP;
-            break;
-        }
-        if (!_stricmp(pCmd, "o") || !_stricmp(pCmd, "Over")) {
-            cmd = OVER;
-            break;
-        }
-        if (!_stricmp(pCmd, "f") || !_stricmp(pCmd, "Finish")) {
-            cmd = FINISH;
-            break;
-        }
-        else if (!_stricmp(pCmd, "r") || !_stricmp(pCmd, "run")) {
-            cmd = RUN;
-            lua_pushliteral(L, "breakpoints");
-            lua_rawget(L, -2);
-            lua_pushnil(L);
-            if (!lua_next(L, -2)) { //When no breakpoints exists, disable the hook.
-                lua_sethook(L, hook, 0, 0);
-                lua_pop(L, 1);
-            }
-            else
-                lua_pop(L, 3);
-            break;
-        }
-        else if (!_stricmp(pCmd, "ll") || !_stricmp(pCmd, "listLocals")) {
-            listLocals(L, ar, p, end);
-        }
-        else if (!_stricmp(pCmd, "lu") || !_stricmp(pCmd, "listUpVars")) {
-            listUpVars(L, ar, p, end);
-        }
-        else if (!_stricmp(pCmd, "ps") || !_stricmp(pCmd, "printStack")) {
-            printStack(L);
+    while (*s) {
+        if (*pattern == '*') {
+            star = ++pattern;
+            back = s;
         }
-        else if (!_stricmp(pCmd, "w") || !_stricmp(pCmd, "watch")) {
-            watch(L, ar, p, end);
+        else if (*pattern == '?' || *pattern == *s) {
+            pattern++;
+            s++;
         }
-        else if (!_stricmp(pCmd, "e") || !_stricmp(pCmd, "exec")) {
-            exec(L, ar, p, end);
+        else if (star) {
+            pattern = star;
+            s = ++back;
         }
-        else if (!_stricmp(pCmd, "sb") || !_stricmp(pCmd, "setBreakPoint")) {
-            setBreakPoint(L, ar->short_src, p, end, 0);
-        }
-        else if (!_stricmp(pCmd, "db") || !_stricmp(pCmd, "delBreakPoint")) {
-            setBreakPoint(L, ar->short_src, p, end, 1);
-        }
-        else if (!_stricmp(pCmd, "lb") || !_stricmp(pCmd, "listBreakPoints")) {
-            listBreakPoints(L);
+        else
+            return 0;
+    }
+    while (*pattern == '*')
+        pattern++;
+    return !*pattern;
+}
+
+/*
+** Make room for a record of size bytes in the arena, dropping the oldest
+** events if needed. Return NULL if the record can never fit.
+*/
+static unsigned char * recReserve(size_t size)
+{
+    unsigned char * p;
+
+    if (size > g_rec.cap)
+        return NULL;
+    while (1) {
+        if (!g_rec.count) {
+            g_rec.head = g_rec.tail = 0;
+            g_rec.wrapped = 0;
         }
-        else if (!_stricmp(pCmd, "h") || !_stricmp(pCmd, "help")) {
-            showHelp();
+        if (!g_rec.wrapped) {
+            if (g_rec.cap - g_rec.tail >= size)
+                break;
+            g_rec.wrap = g_rec.tail;
+            g_rec.tail = 0;
+            g_rec.wrapped = 1;
         }
         else {
-            printf("Invalid command! Type 'help' or 'h' for help.\n");
+            RecEvent ev;
+
+            if (g_rec.head - g_rec.tail >= size)
+                break;
+            memcpy(&ev, g_rec.arena + g_rec.head, sizeof(ev));
+            g_rec.head += ev.size;
+            g_rec.count--;
+            g_rec.evicted++;
+            if (g_rec.head == g_rec.wrap) {
+                g_rec.head = 0;
+                g_rec.wrapped = 0;
+            }
         }
     }
-
-    lua_pushliteral(L, "cmd");
-    lua_pushinteger(L, cmd);
-    lua_rawset(L, -3);
-    assert(top == lua_gettop(L));
-
-    RestoreTextColor();
+    p = g_rec.arena + g_rec.tail;
+    g_rec.tail += size;
+    g_rec.count++;
+    return p;
 }
 
-char * parseOneArg(char * begin, char * end, char ** endPtr)
+/*
+** Offset of the event following the one of size bytes at pos.
+*/
+static size_t recAdvance(size_t pos, size_t size)
 {
-    char * p;
-    char * pArg;
-    for (p = begin; p != end && isspace(*p); ++p);
-    if (p == end)
-        return NULL;
-
-    pArg = p;
-    for (; p!= end && !isspace(*p); ++p);
-    *p = 0;
-    if (endPtr)
-        *endPtr = p;
-    return pArg;
+    pos += size;
+    if (g_rec.wrapped && pos == g_rec.wrap)
+        pos = 0;
+    return pos;
 }
 
-static int sortKey(lua_State * L);
-
 /*
-** A key-value pair is on top of L. L stays unchanged after call.
+** Value of the stack top in shadow form. L stays unchanged after call.
 */
-static void printTabPair(lua_State * L, int leadingSp)
+static void recShadow(lua_State * L, const char * name, RecSlot * slot)
 {
-    int keytype = lua_type(L, -2);
-    int valtype = lua_type(L, -1);
-
-    switch(keytype) {
-        case LUA_TSTRING: {
-            printf("%*s* KT(string) \tKey(%s) \t", leadingSp, "", lua_tostring(L, -2));
+    slot->name = name;
+    slot->type = lua_type(L, -1);
+    slot->p = NULL;
+    slot->n = 0;
+    slot->len = 0;
+    switch (slot->type) {
+        case LUA_TNUMBER:
+            slot->n = lua_tonumber(L, -1);
             break;
-        }
-        case LUA_TNUMBER: {
-            printf("%*s* KT(number) \tKey(%.8f) \t", leadingSp, "", lua_tonumber(L, -2));
+        case LUA_TBOOLEAN:
+            slot->n = lua_toboolean(L, -1);
             break;
-        }
-        case LUA_TTABLE: {
-            printf("%*s* KT(table) \tKey(%08X) \t", leadingSp, "", lua_topointer(L, -2));
+        case LUA_TSTRING:
+            //strings are interned and anchored, so equal pointers mean equal contents
+            slot->p = lua_tolstring(L, -1, &slot->len);
             break;
-        }
-        case LUA_TFUNCTION: {
-            printf("%*s* KT(function) \tKey(%08X) \t", leadingSp, "", lua_topointer(L, -2));
+        case LUA_TNIL:
             break;
-        }
-        case LUA_TUSERDATA: {
-            printf("%*s* KT(userdata) \tKey(%08X) \t", leadingSp, "", lua_topointer(L, -2));
+        default:
+            slot->p = lua_topointer(L, -1);
             break;
-        }
-        case LUA_TLIGHTUSERDATA: {
-            printf("%*s* KT(light userdata) \tKey(%08X) \t", leadingSp, "", lua_topointer(L, -2));
+    }
+}
+
+/*
+** Encode the value on top of L as a value entry at buf. Return its size.
+*/
+static size_t recEncode(lua_State * L, int slot, const char * name, unsigned char * buf)
+{
+    size_t len = strlen(name);
+    unsigned char * p = buf;
+    int type = lua_type(L, -1);
+
+    if (len > REC_NAME_LEN)
+        len = REC_NAME_LEN;
+    *p++ = (unsigned char)slot;
+    *p++ = (unsigned char)type;
+    *p++ = (unsigned char)len;
+    memcpy(p, name, len);
+    p += len;
+
+    switch (type) {
+        case LUA_TNUMBER: {
+            lua_Number n = lua_tonumber(L, -1);
+            memcpy(p, &n, sizeof(n));
+            p += sizeof(n);
             break;
         }
         case LUA_TBOOLEAN: {
-            printf("%*s* KT(boolean) \tKey(%s) \t", leadingSp, "", lua_toboolean(L, -2) ? "true" : "false");
-            break;
-        }
-        case LUA_TTHREAD: {
-            printf("%*s* KT(thread) \tKey(%08X) \t", leadingSp, "", lua_topointer(L, -2));
-            break;
-        }
-        case LUA_TNIL: {
-            printf("%*s* KT(nil) \tKey(nil) \t", leadingSp, "");
+            *p++ = (unsigned char)lua_toboolean(L, -1);
             break;
         }
-    }
-
-    switch(valtype) {
         case LUA_TSTRING: {
-            printf("VT(string) \tVal(%s)\n", lua_tostring(L, -1));
-            break;
-        }
-        case LUA_TNUMBER: {
-            printf("VT(number) \tVal(%.8f)\n", lua_tonumber(L, -1));
+            size_t sz;
+            const char * s = lua_tolstring(L, -1, &sz);
+            unsigned int total = (unsigned int)sz;
+            memcpy(p, &total, 4);
+            p += 4;
+            if (sz > REC_STR_PREFIX)
+                sz = REC_STR_PREFIX;
+            *p++ = (unsigned char)sz;
+            memcpy(p, s, sz);
+            p += sz;
             break;
         }
-        case LUA_TTABLE: {
-            printf("VT(table) \tVal(%08X)\n", lua_topointer(L, -1));
+        case LUA_TNIL: {
             break;
         }
-        case LUA_TFUNCTION: {
-            printf("VT(function) \tVal(%08X)\n", lua_topointer(L, -1));
+        default: {
+            const void * ptr = lua_topointer(L, -1);
+            memcpy(p, &ptr, sizeof(ptr));
+            p += sizeof(ptr);
             break;
         }
-        case LUA_TUSERDATA: {
-            printf("VT(userdata) \tVal(%08X)\n", lua_topointer(L, -1));
-            break;
+    }
+    return p - buf;
+}
+
+/*
+** Get the id of the function at ar, which must match the filter. Closures
+** of the same function definition share an id, so that a callback created in
+** a loop takes a single slot. Return -1 if all slots are taken.
+*/
+static int recNewFuncId(lua_Debug * ar)
+{
+    RecFunc * f;
+    int fid;
+
+    for (fid = 0; fid < g_rec.nfuncs; fid++) {
+        f = &g_rec.funcs[fid];
+        if (f->linedefined == ar->linedefined && !strcmp(f->src, ar->short_src))
+            return fid;
+    }
+    if (g_rec.nfuncs == REC_MAX_FUNCS) {
+        if (!g_rec.funcsFull)
+            fprintf(g_out, "Recording: more than %d functions match, %s:%d and later ones are left out.\n",
+                REC_MAX_FUNCS, ar->short_src, ar->linedefined);
+        g_rec.funcsFull = 1;
+        return -1;
+    }
+    f = &g_rec.funcs[g_rec.nfuncs];
+    strcpy(f->src, ar->short_src);
+    f->linedefined = ar->linedefined;
+    f->name[REC_NAME_LEN] = 0;
+    strncpy(f->name, ar->name ? ar->name : "(N/A)", REC_NAME_LEN);
+    return g_rec.nfuncs++;
+}
+
+/*
+** Look up the recorder function id of the running function. A match of the
+** filter on the source is resolved on first sight and cached per function.
+** The name a function is called by belongs to the call site, so it is
+** matched once per activation instead, which hook() marks by clearing
+** g_rec.frameL on calls and returns. Return -1 if the function isn't
+** recorded.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
+*/
+static int recFuncId(lua_State * L, lua_Debug * ar)
+{
+    int fid = -1;
+
+    if (g_rec.frameL == L)
+        return g_rec.frameFid;
+    lua_pushliteral(L, "recindex");
+    lua_rawget(L, -2);
+    lua_getinfo(L, "f", ar);
+    lua_pushvalue(L, -1);
+    lua_rawget(L, -3);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        lua_getinfo(L, "nS", ar);
+        if (matchGlob(g_rec.filter, ar->short_src) && (fid = recNewFuncId(ar)) >= 0)
+            lua_pushinteger(L, fid);
+        else
+            lua_pushboolean(L, 0);
+        lua_pushvalue(L, -2);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, -5);
+    }
+    if (lua_isnumber(L, -1))
+        fid = lua_tointeger(L, -1);
+    else {
+        lua_getinfo(L, "nS", ar);
+        if (ar->name && matchGlob(g_rec.filter, ar->name))
+            fid = recNewFuncId(ar);
+    }
+    lua_pop(L, 3);
+    g_rec.frameL = L;
+    g_rec.frameFid = fid;
+    return fid;
+}
+
+/*
+** Log the current line event if the running function is recorded. Only
+** changes since the previous event are logged, unless the frame isn't the
+** shadowed one: another thread or function, a call made by the shadowed
+** frame, or a new frame after it returned (see hook()).
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
+*/
+static void recordLine(lua_State * L, lua_Debug * ar)
+{
+    static unsigned char buf[REC_MAX_SLOTS * REC_MAX_ENTRY];
+    LARGE_INTEGER t0, t1;
+    RecEvent ev;
+    unsigned char * p;
+    size_t size = 0;
+    const char * name;
+    int fid;
+    int full;
+    int i;
+
+    QueryPerformanceCounter(&t0);
+    g_rec.lines++;
+    fid = recFuncId(L, ar);
+    if (fid < 0) {
+        if (g_rec.shadowL == L && !g_rec.shadowDepth)
+            g_rec.shadowL = NULL;
+        goto done;
+    }
+
+    full = g_rec.shadowL != L || g_rec.shadowFid != fid || g_rec.shadowDepth;
+    memset(&ev, 0, sizeof(ev));
+    lua_pushliteral(L, "recshadow");
+    lua_rawget(L, -2);
+    for (i = 1; i <= REC_MAX_SLOTS && (name = lua_getlocal(L, ar, i)); i++) {
+        RecSlot cur;
+        RecSlot * old = &g_rec.shadow[i];
+
+        recShadow(L, name, &cur);
+        if (full || i > g_rec.shadowCount || old->name != cur.name || old->type != cur.type
+            || old->p != cur.p || old->n != cur.n || old->len != cur.len) {
+            *old = cur;
+            lua_pushvalue(L, -1);
+            lua_rawseti(L, -3, i);
+            if (*name != '(') { //skip temporaries
+                size += recEncode(L, i, name, buf + size);
+                ev.nvals++;
+            }
+        }
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+    ev.nslots = (unsigned char)(i - 1);
+    g_rec.shadowCount = i - 1;
+    g_rec.shadowL = L;
+    g_rec.shadowFid = fid;
+    g_rec.shadowDepth = 0;
+
+    ev.size = (unsigned short)(sizeof(ev) + size);
+    ev.flags = full ? REC_FULL : 0;
+    ev.fid = (unsigned short)fid;
+    ev.line = ar->currentline;
+    ev.seq = g_rec.seq + 1;
+    if (!(p = recReserve(ev.size))) {
+        g_rec.shadowL = NULL;
+        goto done;
+    }
+    memcpy(p, &ev, sizeof(ev));
+    memcpy(p + sizeof(ev), buf, size);
+    g_rec.cursor = ++g_rec.seq;
+
+done:
+    QueryPerformanceCounter(&t1);
+    g_rec.ticks += t1.QuadPart - t0.QuadPart;
+}
+
+/*
+** Stop recording and free the arena.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
+*/
+static void stopRecording(lua_State * L)
+{
+    free(g_rec.arena);
+    g_rec.arena = NULL;
+    lua_pushliteral(L, "recindex");
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "recshadow");
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+}
+
+/*
+** Start recording functions matching filter into an arena of kbytes KB,
+** dropping any previous recording. Return 0 if the arena can't be allocated.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+static int startRecording(lua_State * L, const char * filter, int kbytes)
+{
+    stopRecording(L);
+    memset(&g_rec, 0, sizeof(g_rec));
+    g_rec.cap = (size_t)(kbytes > 0 ? kbytes : REC_ARENA_KB) * 1024;
+    if (!(g_rec.arena = (unsigned char *)malloc(g_rec.cap)))
+        return 0;
+    g_rec.filter[REC_FILTER_LEN - 1] = 0;
+    strncpy(g_rec.filter, filter, REC_FILTER_LEN - 1);
+
+    //functions are cached weakly so that the index doesn't keep them alive
+    lua_pushliteral(L, "recindex");
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushliteral(L, "__mode");
+    lua_pushliteral(L, "k");
+    lua_rawset(L, -3);
+    lua_setmetatable(L, -2);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "recshadow");
+    lua_newtable(L);
+    lua_rawset(L, -3);
+
+    lua_sethook(L, hook, LUA_MASKLINE | LUA_MASKCALL | LUA_MASKRET, 0);
+    return 1;
+}
+
+/*
+** Line-level profiler. Every line event increments a counter in a dense
+** array of the running chunk, indexed by line, and optionally adds the time
+** elapsed since the previous line event to the line that was running.
+** Chunks are told apart by the address of their source string. The strings
+** are anchored in the "heatsources" table of the "debugger" table, so an
+** address can't be reused by another chunk and the previous chunk can be
+** recognized by a single pointer comparison.
+*/
+typedef struct HeatChunk {
+    const char * source;
+    char path[_MAX_PATH + 1];   //normalized path of file chunks, or ""
+    unsigned long * counts;
+    LONGLONG * ticks;
+    int size;
+    struct HeatChunk * next;
+    struct HeatChunk * hashNext;
+} HeatChunk;
+
+#define HEAT_BUCKETS 256
+
+static struct {
+    int on;
+    int timing;
+    HeatChunk * chunks;
+    HeatChunk * buckets[HEAT_BUCKETS]; //chunks hashed by source pointer
+    HeatChunk * frame;          //chunk of the running function, NULL if unknown
+    lua_State * frameL;
+    HeatChunk * last;           //chunk of the previous line event
+    int lastLine;
+    LONGLONG lastTick;
+    unsigned long total;
+} g_heat;
+
+/*
+** Find or create the profile of the chunk whose source is in ar. Return NULL
+** if out of memory.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+static HeatChunk * heatChunk(lua_State * L, lua_Debug * ar)
+{
+    size_t h = ((size_t)ar->source >> 3 ^ (size_t)ar->source >> 11) % HEAT_BUCKETS;
+    HeatChunk * c;
+
+    for (c = g_heat.buckets[h]; c; c = c->hashNext) {
+        if (c->source == ar->source)
+            return c;
+    }
+    if (!(c = (HeatChunk *)calloc(1, sizeof(HeatChunk))))
+        return NULL;
+
+    lua_pushliteral(L, "heatsources");
+    lua_rawget(L, -2);
+    lua_pushstring(L, ar->source);
+    c->source = lua_tostring(L, -1);
+    lua_rawseti(L, -2, lua_objlen(L, -2) + 1);
+    lua_pop(L, 1);
+    assert(c->source == ar->source);
+
+    if (*ar->source != '@' || !fullPath(ar->source + 1, c->path))
+        c->path[0] = 0;
+    c->next = g_heat.chunks;
+    g_heat.chunks = c;
+    c->hashNext = g_heat.buckets[h];
+    g_heat.buckets[h] = c;
+    return c;
+}
+
+/*
+** Make sure the arrays of c can be indexed by line.
+*/
+static int heatGrow(HeatChunk * c, int line)
+{
+    int size = c->size ? c->size : 64;
+    unsigned long * counts;
+    LONGLONG * ticks;
+
+    while (size <= line)
+        size *= 2;
+    if (!(counts = (unsigned long *)realloc(c->counts, size * sizeof(*counts))))
+        return 0;
+    memset(counts + c->size, 0, (size - c->size) * sizeof(*counts));
+    c->counts = counts;
+    if (!(ticks = (LONGLONG *)realloc(c->ticks, size * sizeof(*ticks))))
+        return 0;
+    memset(ticks + c->size, 0, (size - c->size) * sizeof(*ticks));
+    c->ticks = ticks;
+    c->size = size;
+    return 1;
+}
+
+/*
+** Count the current line event. The chunk is looked up once per function
+** activation: hook() forgets it on every call and return event, and lines
+** in between share it without asking lua_getinfo() for the source again.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+static void profileLine(lua_State * L, lua_Debug * ar)
+{
+    HeatChunk * c;
+    int line = ar->currentline;
+
+    if (g_heat.timing) {
+        LARGE_INTEGER now;
+
+        QueryPerformanceCounter(&now);
+        if (g_heat.last)
+            g_heat.last->ticks[g_heat.lastLine] += now.QuadPart - g_heat.lastTick;
+        g_heat.lastTick = now.QuadPart;
+    }
+
+    c = g_heat.frame;
+    if (!c || g_heat.frameL != L) {
+        lua_getinfo(L, "S", ar);
+        c = g_heat.frame = heatChunk(L, ar);
+        g_heat.frameL = L;
+    }
+    if (!c || (line >= c->size && !heatGrow(c, line))) {
+        g_heat.last = NULL;
+        return;
+    }
+    c->counts[line]++;
+    g_heat.total++;
+    g_heat.last = c;
+    g_heat.lastLine = line;
+}
+
+/*
+** Drop all profile data.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+static void resetProfile(lua_State * L)
+{
+    while (g_heat.chunks) {
+        HeatChunk * c = g_heat.chunks;
+        g_heat.chunks = c->next;
+        free(c->counts);
+        free(c->ticks);
+        free(c);
+    }
+    memset(g_heat.buckets, 0, sizeof(g_heat.buckets));
+    g_heat.frame = NULL;
+    g_heat.last = NULL;
+    g_heat.total = 0;
+    lua_pushliteral(L, "heatsources");
+    lua_newtable(L);
+    lua_rawset(L, -3);
+}
+
+/*
+** Value rendering. Strings are printed by their real length, escaping
+** control characters, or as a hex dump when they look binary. Output is
+** bounded by a per-value and a per-command byte budget, and whatever is cut
+** is marked with "...(N bytes more)", so inspecting a frame costs no more
+** than the budget whatever the size of the values. __tostring is only called
+** when asked for, in a separate thread that is aborted after a time limit.
+*/
+#define RENDER_VALUE_BUDGET 256
+#define RENDER_COMMAND_BUDGET 16384
+#define RENDER_TOSTRING_TIMEOUT 100
+
+static struct {
+    size_t valueBudget;
+    size_t commandBudget;
+    size_t used;            //bytes rendered by the current command
+    int tostring;           //call __tostring metamethods
+    DWORD timeout;          //ms a __tostring call may take
+    DWORD deadline;
+} g_render = { RENDER_VALUE_BUDGET, RENDER_COMMAND_BUDGET, 0, 0, RENDER_TOSTRING_TIMEOUT, 0 };
+
+static void prompt(lua_State *L, lua_Debug * ar);
+static void batchStop(lua_State *L, lua_Debug * ar);
+static int stop(lua_State *L, lua_Debug * ar);
+static int checkBreakPoint(lua_State *L, lua_Debug * ar);
+static void checkFuncBreakPoint(lua_State *L, lua_Debug * ar);
+
+/*
+** Lua 5.1 has no notion of a hook having yielded: a resumed thread fetches
+** the instruction it yielded at again, and runs the line hook for it once
+** more unless the instruction before is on the same line. So poll() puts a
+** thread it resumes in the "resuming" table and has it run the count hook
+** for every instruction. The count event of the refetched instruction comes
+** before its repeated line event, if any, and marks the entry; the count
+** event of the next instruction drops the entry and the count hook. Return 1
+** if this event has to be ignored: a count event, or the repeated line event.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+static int resumedEvent(lua_State * L, int event)
+{
+    int state;
+
+    lua_pushliteral(L, "resuming");
+    lua_rawget(L, -2);
+    lua_pushthread(L);
+    lua_rawget(L, -2);
+    state = lua_isnil(L, -1) ? -1 : lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    if (event == LUA_HOOKLINE) {
+        lua_pop(L, 1);
+        return state == 1;
+    }
+
+    if (state == 0) {
+        lua_pushthread(L);
+        lua_pushinteger(L, 1);
+        lua_rawset(L, -3);
+    }
+    else {
+        if (state == 1) {
+            lua_pushthread(L);
+            lua_pushnil(L);
+            lua_rawset(L, -3);
+            g_resuming--;
+        }
+        lua_sethook(L, hook, lua_gethookmask(L) & ~LUA_MASKCOUNT, 0);
+    }
+    lua_pop(L, 1);
+    return 1;
+}
+
+/*
+** Check if L is the thread the current step command (STEP, OVER or FINISH)
+** was given to, which the "stepthread" field of the "debugger" table holds.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
+*/
+static int isStepThread(lua_State * L)
+{
+    int self;
+
+    lua_pushliteral(L, "stepthread");
+    lua_rawget(L, -2);
+    lua_pushthread(L);
+    self = lua_rawequal(L, -1, -2);
+    lua_pop(L, 2);
+    return self;
+}
+
+void hook(lua_State * L, lua_Debug * ar)
+{
+    int event = ar->event;
+    int top;
+    int cmd;
+    int suspend = 0;
+
+    if (g_inCommand)
+        return;
+    top = lua_gettop(L);
+
+    lua_pushliteral(L, "debugger");
+    lua_rawget(L, LUA_REGISTRYINDEX);
+
+    if ((event == LUA_HOOKCOUNT || (event == LUA_HOOKLINE && g_resuming)) && resumedEvent(L, event)) {
+        lua_pop(L, 1);
+        return;
+    }
+
+    //other threads only check breakpoints while one is stepped
+    lua_pushliteral(L, "cmd");
+    lua_rawget(L, -2);
+    cmd = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    if (cmd != RUN && !isStepThread(L))
+        cmd = RUN;
+
+    if (event == LUA_HOOKLINE) {
+        if (g_rec.arena)
+            recordLine(L, ar);
+        if (g_heat.on)
+            profileLine(L, ar);
+
+        if (cmd == STEP) {
+            lua_pushliteral(L, "stacklevel");
+            lua_pushinteger(L, 0);
+            lua_rawset(L, -3);
+            suspend = stop(L, ar);
+        }
+        else if (cmd == OVER) {
+            int level;
+
+            lua_pushliteral(L, "stacklevel");
+            lua_rawget(L, -2);
+            level = lua_tointeger(L, -1);
+            lua_pop(L, 1);
+            if (!level)
+                suspend = stop(L, ar);
+            else
+                suspend = checkBreakPoint(L, ar);
+        }
+        else if (cmd == FINISH) {
+            //prompt(L, ar);
+        }
+        else if (cmd == RUN) {
+            suspend = checkBreakPoint(L, ar);
+        }
+    }
+    else {
+        assert(event != LUA_HOOKCOUNT);
+
+        g_heat.frame = NULL;
+        g_rec.frameL = NULL;
+        if (L == g_rec.shadowL) { //follow the calls made by the shadowed frame
+            if (event == LUA_HOOKCALL)
+                g_rec.shadowDepth++;
+            else if (g_rec.shadowDepth)
+                g_rec.shadowDepth--;
+            else
+                g_rec.shadowL = NULL; //the shadowed frame returns
+        }
+
+        if (event == LUA_HOOKCALL)
+            checkFuncBreakPoint(L, ar);
+        if (cmd != RUN) { //the stepped thread counts its calls for OVER
+            int level;
+
+            lua_pushliteral(L, "stacklevel");
+            lua_rawget(L, -2);
+            level = lua_tointeger(L, -1);
+            lua_pop(L, 1);
+
+            if (event == LUA_HOOKCALL)
+                level++;
+            else if (event == LUA_HOOKRET || event == LUA_HOOKTAILRET) {
+                if (level)
+                    level--;
+            }
+            lua_pushliteral(L, "stacklevel");
+            lua_pushinteger(L, level);
+            lua_rawset(L, -3);
+        }
+    }
+    lua_pop(L, 1);
+    assert(top == lua_gettop(L));
+
+    /* Only line hooks may yield, and only as the very last thing they do. */
+    if (suspend)
+        lua_yield(L, 0);
+}
+
+/*
+** Print where the debuggee stopped. ar has been filled by "nSl".
+*/
+static void printWhere(lua_Debug * ar, const char * note)
+{
+    fprintf(g_out, "%s \tLine:%d \tName:%s \tWhat:%s%s\n", ar->short_src, ar->currentline,
+        ar->name ? ar->name : "(N/A)", *ar->what ? ar->what : "(N/A)", note);
+}
+
+/*
+** Check if the hook can yield L. Lua 5.1 refuses to yield across a C call
+** boundary: a C function such as pcall or table.sort on the stack, or a Lua
+** function the VM itself called for a metamethod or a for-in iterator.
+** Those leave no C frame, but no call instruction names them either, so a
+** Lua function called from Lua code without a name counts as a boundary.
+** Anonymous calls like f()() then stop in the prompt too, which is safe.
+*/
+static int canYield(lua_State * L)
+{
+    lua_Debug ar;
+    lua_Debug caller;
+    int level;
+
+    for (level = 0; lua_getstack(L, level, &ar); level++) {
+        lua_getinfo(L, "nS", &ar);
+        if (*ar.what == 'C')
+            return 0;
+        if (!lua_getstack(L, level + 1, &caller))
+            break; //the body of the coroutine
+        lua_getinfo(L, "S", &caller);
+        if (strcmp(ar.what, "tail") && *caller.what != 'C' && strcmp(caller.what, "tail")
+            && (!ar.name || !strncmp(ar.name, "(for ", 5)))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+** Stop at the current line. In batch mode the actions of the stop are run.
+** In async mode a coroutine is registered as
+** "debug-paused" and 1 is returned, so that the hook yields it back to the
+** host. The main thread can't yield, so it always falls back to prompt(),
+** and so does a coroutine stopped below a C call boundary. Registering it
+** anyway would leave it "debug-paused" forever after lua_yield() failed.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+int stop(lua_State *L, lua_Debug * ar)
+{
+    int async;
+
+    lua_pushliteral(L, "async");
+    lua_rawget(L, -2);
+    async = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+
+    g_heat.last = NULL; //time spent stopped isn't billed to the line
+
+    if (g_batch.on) {
+        batchStop(L, ar);
+        return 0;
+    }
+    if (async) {
+        async = !lua_pushthread(L);
+        lua_pop(L, 1);
+        if (async && !canYield(L)) {
+            fprintf(g_out, "Can't yield across a C call here, stopping in place.\n");
+            async = 0;
+        }
+    }
+    if (!async) {
+        prompt(L, ar);
+        return 0;
+    }
+
+    ChangeTextColor();
+    lua_getinfo(L, "nSl", ar);
+    printWhere(ar, " \t(debug-paused)");
+    RestoreTextColor();
+
+    lua_pushliteral(L, "paused");
+    lua_rawget(L, -2);
+    lua_pushthread(L);
+    lua_newtable(L);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    return 1;
+}
+
+/*
+** Check if the current line contains a breakpoint. If yes, break and prompt
+** for user, and reset statck level to 0 preparing for the next "OVER" command.
+** Return 1 if the thread has to be suspended (see stop()).
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+int checkBreakPoint(lua_State *L, lua_Debug * ar)
+{
+    int breakpoint = 0;
+
+    lua_getinfo(L, "Sl", ar);
+    pushChunkPath(L, ar);
+    if (lua_isstring(L, -1)) {
+        lua_pushliteral(L, "breakpoints");
+        lua_rawget(L, -3);
+        lua_pushvalue(L, -2);
+        lua_rawget(L, -2);
+        if (lua_istable(L, -1)) {
+            lua_rawgeti(L, -1, ar->currentline);
+            breakpoint = lua_isnil(L, -1) ? 0 : 1;
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 2);
+    }
+    lua_pop(L, 1);
+
+    if (breakpoint)
+        return stop(L, ar);
+    return 0;
+}
+
+/*
+** Check if a called function matches a function breakpoint pattern by what
+** belongs to the function itself: its source or "source:linedefined" matches
+** the pattern, or the pattern is a path like "Shop:buy" or "net.send" naming
+** this very function from the globals. Returns 1 on a match, -1 for a C
+** function, which has no line to stop at, and 0 otherwise.
+** The called function is on top of L. L stays unchanged after call.
+*/
+static int matchFuncBreakPoint(lua_State *L, lua_Debug * ar)
+{
+    char where[LUA_IDSIZE + 16];
+    int found = 0;
+
+    lua_getinfo(L, "S", ar);
+    if (*ar->what == 'C')
+        return -1;
+    sprintf(where, "%s:%d", ar->short_src, ar->linedefined);
+
+    lua_pushliteral(L, "debugger");
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    lua_pushliteral(L, "funcbreakpoints");
+    lua_rawget(L, -2);
+    lua_pushnil(L);
+    while (!found && lua_next(L, -2)) {
+        const char * pattern = lua_tostring(L, -2);
+
+        if (matchGlob(pattern, ar->short_src) || matchGlob(pattern, where))
+            found = 1;
+        else if (!strpbrk(pattern, "*?") && strpbrk(pattern, ".:")) {
+            const char * p = pattern;
+
+            lua_pushvalue(L, LUA_GLOBALSINDEX);
+            while (*p && lua_istable(L, -1)) {
+                size_t len = strcspn(p, ".:");
+
+                lua_pushlstring(L, p, len);
+                lua_rawget(L, -2);
+                lua_remove(L, -2);
+                p += len;
+                if (*p)
+                    p++;
+            }
+            found = !*p && lua_rawequal(L, -1, -6);
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+    }
+    lua_pop(L, found ? 3 : 2);
+    return found;
+}
+
+/*
+** Check if the name a function is called by matches a function breakpoint
+** pattern. The name belongs to the call site, so it is looked up per call.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
+*/
+static int matchFuncName(lua_State *L, lua_Debug * ar)
+{
+    int found = 0;
+
+    lua_getinfo(L, "n", ar);
+    if (!ar->name)
+        return 0;
+    lua_pushliteral(L, "funcbreakpoints");
+    lua_rawget(L, -2);
+    lua_pushnil(L);
+    while (!found && lua_next(L, -2)) {
+        found = matchGlob(lua_tostring(L, -2), ar->name);
+        lua_pop(L, 1);
+    }
+    lua_pop(L, found ? 2 : 1);
+    return found;
+}
+
+/*
+** Check if a function breakpoint matches the function being called. The
+** first call of a function resolves what belongs to the function itself
+** against all patterns and caches the result in the "funcindex" table keyed
+** by the function, so that part costs a single table lookup afterwards. A Lua
+** function not matched that way is still matched by the name of each call.
+** "funcindex" only exists while there are function breakpoints. On a match
+** the debugger steps, stopping at the first line of the function.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+void checkFuncBreakPoint(lua_State *L, lua_Debug * ar)
+{
+    int breakpoint;
+
+    lua_pushliteral(L, "funcindex");
+    lua_rawget(L, -2);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        return;
+    }
+    lua_getinfo(L, "f", ar);
+    lua_pushvalue(L, -1);
+    lua_rawget(L, -3);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        lua_pushinteger(L, matchFuncBreakPoint(L, ar));
+        lua_pushvalue(L, -2);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, -5);
+    }
+    breakpoint = lua_tointeger(L, -1);
+    lua_pop(L, 3);
+    if (!breakpoint)
+        breakpoint = matchFuncName(L, ar);
+
+    if (breakpoint > 0) {
+        lua_pushliteral(L, "cmd");
+        lua_pushinteger(L, STEP);
+        lua_rawset(L, -3);
+        lua_pushliteral(L, "stepthread");
+        lua_pushthread(L);
+        lua_rawset(L, -3);
+        lua_pushliteral(L, "stacklevel");
+        lua_pushinteger(L, 0);
+        lua_rawset(L, -3);
+    }
+}
+
+static char * parseOneArg(char * begin, char * end, char ** endPtr);
+static void watch(lua_State * L, lua_Debug * ar, const Action * a);
+static void exec(lua_State * L, const Action * a);
+static void listLocals(lua_State * L, lua_Debug * ar, const Action * a);
+static void listUpVars(lua_State * L, lua_Debug * ar, const Action * a);
+static void printStack(lua_State * L);
+static int breakPointPath(const char * src, const char * file, char * path);
+static void setBreakPoint(lua_State * L, const char * src, const Action * a, int del);
+static void toggleBreakPoint(lua_State * L, const char * path, int line, int del);
+static void setFuncBreakPoint(lua_State * L, const Action * a, int del);
+static void listBreakPoints(lua_State * L);
+static void record(lua_State * L, const Action * a);
+static void rewindHistory(int n);
+static void varHistory(const char * name);
+static void profile(lua_State * L, const Action * a);
+static void setOption(const Action * a);
+static void heatmap(const char * src, const Action * a);
+static void showHelp();
+
+#define CMD_LINE 1024
+
+/*
+** Commands indexed by op - STEP. frame marks the commands that need a
+** stopped debuggee, which batch scripts can't run when loaded.
+*/
+static const struct {
+    const char * abbr;
+    const char * name;
+    int minArgs;
+    int frame;
+} g_commands[] = {
+    { "s", "step", 0, 1 },
+    { "o", "over", 0, 1 },
+    { "f", "finish", 0, 1 },
+    { "r", "run", 0, 1 },
+    { "ll", "listLocals", 0, 1 },
+    { "lu", "listUpVars", 0, 1 },
+    { "ps", "printStack", 0, 1 },
+    { "w", "watch", 1, 1 },
+    { "e", "exec", 1, 0 },
+    { "sb", "setBreakPoint", 2, 0 },
+    { "db", "delBreakPoint", 2, 0 },
+    { "bf", "setFuncBreakPoint", 1, 0 },
+    { "df", "delFuncBreakPoint", 1, 0 },
+    { "lb", "listBreakPoints", 0, 0 },
+    { "rec", "record", 0, 0 },
+    { "bk", "back", 0, 0 },
+    { "rw", "rewind", 1, 0 },
+    { "hi", "history", 1, 0 },
+    { "pf", "profile", 0, 0 },
+    { "hm", "heatmap", 0, 0 },
+    { "set", "set", 0, 0 },
+    { "h", "help", 0, 0 }
+};
+
+static const Action g_runAction = { RUN };
+
+static int doCommand(lua_State * L, lua_Debug * ar, const char * line);
+static int runAction(lua_State * L, lua_Debug * ar, const Action * a);
+
+/*
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+void prompt(lua_State * L, lua_Debug * ar)
+{
+    int cmd = 0;
+    int top = lua_gettop(L);
+
+    ChangeTextColor();
+
+    lua_getinfo(L, "nSl", ar);
+    printWhere(ar, "");
+
+    while (!cmd) {
+        char buf[CMD_LINE];
+
+        printf("?>");
+        if (!fgets(buf, CMD_LINE, stdin)) { //no more input, let the debuggee go
+            cmd = runAction(L, ar, &g_runAction);
+            break;
+        }
+        cmd = doCommand(L, ar, buf);
+    }
+    assert(top == lua_gettop(L));
+
+    RestoreTextColor();
+}
+
+static int isWord(const char * p, size_t len, const char * word)
+{
+    return strlen(word) == len && !_strnicmp(p, word, len);
+}
+
+/*
+** Compile a command line into an Action to be freed by the caller. Return
+** NULL after telling why if the line isn't a valid command.
+*/
+static Action * compileCommand(const char * line)
+{
+    const char * p = line + strspn(line, " \t\r\n");
+    size_t len = strcspn(p, " \t\r\n");
+    const char * rest;
+    size_t restLen;
+    Action * a;
+    char * args;
+    char * end;
+    int op;
+
+    if (!len) { //an empty line
+        fprintf(g_out, "Invalid command!\n");
+        return NULL;
+    }
+    for (op = STEP; op <= OP_HELP; op++) {
+        if (isWord(p, len, g_commands[op - STEP].abbr) || isWord(p, len, g_commands[op - STEP].name))
+            break;
+    }
+    if (op > OP_HELP) {
+        fprintf(g_out, "Invalid command! Type 'help' or 'h' for help.\n");
+        return NULL;
+    }
+
+    rest = p + len + strspn(p + len, " \t\r\n");
+    restLen = strlen(rest);
+    while (restLen && isspace((unsigned char)rest[restLen - 1]))
+        restLen--;
+
+    a = malloc(sizeof(Action) + 2 * (restLen + 1));
+    if (!a) {
+        fprintf(g_out, "Out of memory!\n");
+        return NULL;
+    }
+    memset(a, 0, sizeof(Action));
+    a->op = op;
+    a->rest = (char *)(a + 1);
+    memcpy((char *)a->rest, rest, restLen);
+    ((char *)a->rest)[restLen] = 0;
+
+    //the second copy is split into arguments
+    args = (char *)a->rest + restLen + 1;
+    memcpy(args, a->rest, restLen + 1);
+    end = args + restLen;
+    while (a->argc < ACTION_ARGS && args < end) {
+        char * arg = parseOneArg(args, end, &args);
+
+        if (!arg)
+            break;
+        a->argv[a->argc] = arg;
+        a->num[a->argc++] = strtol(arg, NULL, 10);
+        args++;
+    }
+    if (a->argc < g_commands[op - STEP].minArgs) {
+        fprintf(g_out, "Invalid argument!\n");
+        free(a);
+        return NULL;
+    }
+    return a;
+}
+
+/*
+** Run a compiled command. ar is NULL when a batch script runs it on loading.
+** Return the resuming command (STEP, OVER, FINISH or RUN) after storing it
+** into the "debugger" table, or 0 if the debuggee has to stay stopped.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+int runAction(lua_State * L, lua_Debug * ar, const Action * a)
+{
+    const char * src = ar ? ar->short_src : NULL;
+    int cmd = 0;
+
+    g_render.used = 0;
+    switch (a->op) {
+    case STEP:
+    case OVER:
+    case FINISH:
+        cmd = a->op;
+        break;
+    case RUN:
+        cmd = RUN;
+        lua_pushliteral(L, "breakpoints");
+        lua_rawget(L, -2);
+        lua_pushnil(L);
+        if (!lua_next(L, -2)) { //When no breakpoints exists, disable the hook.
+            lua_pushliteral(L, "funcindex");
+            lua_rawget(L, -3);
+            if (lua_isnil(L, -1) && !g_rec.arena && !g_heat.on)
+                lua_sethook(L, hook, 0, 0);
+            lua_pop(L, 2);
+        }
+        else
+            lua_pop(L, 3);
+        break;
+    case OP_LISTLOCALS:
+        listLocals(L, ar, a);
+        break;
+    case OP_LISTUPVARS:
+        listUpVars(L, ar, a);
+        break;
+    case OP_PRINTSTACK:
+        printStack(L);
+        break;
+    case OP_WATCH:
+        watch(L, ar, a);
+        break;
+    case OP_EXEC:
+        exec(L, a);
+        break;
+    case OP_SETBREAKPOINT:
+    case OP_DELBREAKPOINT:
+        setBreakPoint(L, src, a, a->op == OP_DELBREAKPOINT);
+        break;
+    case OP_SETFUNCBREAKPOINT:
+    case OP_DELFUNCBREAKPOINT:
+        setFuncBreakPoint(L, a, a->op == OP_DELFUNCBREAKPOINT);
+        break;
+    case OP_LISTBREAKPOINTS:
+        listBreakPoints(L);
+        break;
+    case OP_RECORD:
+        record(L, a);
+        break;
+    case OP_BACK:
+        rewindHistory(1);
+        break;
+    case OP_REWIND:
+        rewindHistory(a->num[0]);
+        break;
+    case OP_HISTORY:
+        varHistory(a->argv[0]);
+        break;
+    case OP_PROFILE:
+        profile(L, a);
+        break;
+    case OP_HEATMAP:
+        heatmap(src, a);
+        break;
+    case OP_SET:
+        setOption(a);
+        break;
+    case OP_HELP:
+        showHelp();
+        break;
+    }
+
+    if (cmd) {
+        lua_pushliteral(L, "cmd");
+        lua_pushinteger(L, cmd);
+        lua_rawset(L, -3);
+        lua_pushliteral(L, "stepthread");
+        if (cmd == RUN)
+            lua_pushnil(L);
+        else
+            lua_pushthread(L);
+        lua_rawset(L, -3);
+        lua_pushliteral(L, "stacklevel");
+        lua_pushinteger(L, 0);
+        lua_rawset(L, -3);
+    }
+    return cmd;
+}
+
+/*
+** Compile and run one command line, see runAction().
+*/
+int doCommand(lua_State * L, lua_Debug * ar, const char * line)
+{
+    Action * a = compileCommand(line);
+    int cmd;
+
+    if (!a)
+        return 0;
+    cmd = runAction(L, ar, a);
+    free(a);
+    return cmd;
+}
+
+char * parseOneArg(char * begin, char * end, char ** endPtr)
+{
+    char * p;
+    char * pArg;
+    for (p = begin; p != end && isspace(*p); ++p);
+    if (p == end)
+        return NULL;
+
+    pArg = p;
+    for (; p!= end && !isspace(*p); ++p);
+    *p = 0;
+    if (endPtr)
+        *endPtr = p;
+    return pArg;
+}
+
+static const char * typeName(int type)
+{
+    static const char * const names[] = { "nil", "boolean", "light userdata", "number",
+        "string", "table", "function", "userdata", "thread" };
+    return type >= LUA_TNIL && type <= LUA_TTHREAD ? names[type] : "none";
+}
+
+/*
+** Print to g_out, counting the bytes against the budget of the command.
+** Everything a command prints about values goes through here.
+*/
+static void renderf(const char * fmt, ...)
+{
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vfprintf(g_out, fmt, args);
+    va_end(args);
+    if (n > 0)
+        g_render.used += n;
+}
+
+/*
+** Bytes left for the next value.
+*/
+static size_t renderBudget()
+{
+    size_t left = g_render.commandBudget > g_render.used ? g_render.commandBudget - g_render.used : 0;
+    return left < g_render.valueBudget ? left : g_render.valueBudget;
+}
+
+/*
+** Print the first len bytes of a string of total bytes within budget.
+*/
+static void renderBytes(const char * s, size_t len, size_t total)
+{
+    size_t budget = renderBudget();
+    size_t out = 0;
+    size_t binary = 0;
+    size_t i;
+
+    for (i = 0; i < len && i < 256; i++) {
+        unsigned char ch = (unsigned char)s[i];
+        if (ch < 32 && ch != '\n' && ch != '\r' && ch != '\t')
+            binary++;
+    }
+
+    if (binary * 8 > i && budget >= 4) { //more than 1/8 control characters, dump it in hex
+        renderf("hex:");
+        out = 4;
+        for (i = 0; i < len && out + 3 <= budget; i++, out += 3)
+            renderf(" %02X", (unsigned char)s[i]);
+    }
+    else {
+        for (i = 0; i < len; i++) {
+            unsigned char ch = (unsigned char)s[i];
+            char esc[5];
+
+            if (ch == '\n')
+                strcpy(esc, "\\n");
+            else if (ch == '\r')
+                strcpy(esc, "\\r");
+            else if (ch == '\t')
+                strcpy(esc, "\\t");
+            else if (ch == '\\')
+                strcpy(esc, "\\\\");
+            else if (ch < 32 || ch == 127)
+                sprintf(esc, "\\x%02X", ch);
+            else {
+                esc[0] = ch;
+                esc[1] = 0;
+            }
+            if (out + strlen(esc) > budget)
+                break;
+            renderf("%s", esc);
+            out += strlen(esc);
+        }
+    }
+    if (i < total)
+        renderf("...(%lu bytes more)", (unsigned long)(total - i));
+}
+
+/*
+** Count hook aborting a __tostring call that runs past its deadline.
+*/
+static void tostringHook(lua_State * L, lua_Debug * ar)
+{
+    if ((long)(GetTickCount() - g_render.deadline) > 0)
+        luaL_error(L, "__tostring timed out");
+}
+
+/*
+** Call the __tostring metamethod of the value at idx in a new thread with
+** hooks of its own, so that the time limit works even from inside the
+** debugger hook, and print its result or the error it raised.
+** L stays unchanged after call.
+*/
+static void renderToString(lua_State * L, int idx)
+{
+    lua_State * co;
+    int status;
+
+    if (idx < 0)
+        idx = lua_gettop(L) + idx + 1;
+    if (!luaL_getmetafield(L, idx, "__tostring"))
+        return;
+
+    co = lua_newthread(L);
+    lua_pushvalue(L, -2);
+    lua_pushvalue(L, idx);
+    lua_xmove(L, co, 2);
+    g_render.deadline = GetTickCount() + g_render.timeout;
+    lua_sethook(co, tostringHook, LUA_MASKCOUNT, 1000);
+    status = lua_resume(co, 1);
+
+    renderf(" tostring:");
+    if (!status && lua_type(co, -1) == LUA_TSTRING) {
+        size_t len;
+        const char * s = lua_tolstring(co, -1, &len);
+        renderBytes(s, len, len);
+    }
+    else if (status && lua_type(co, -1) == LUA_TSTRING) {
+        size_t len;
+        const char * s = lua_tolstring(co, -1, &len);
+        renderf("(");
+        renderBytes(s, len, len);
+        renderf(")");
+    }
+    else
+        renderf("(no string)");
+    lua_pop(L, 2);
+}
+
+/*
+** Print the value at idx. L stays unchanged after call.
+*/
+static void renderValue(lua_State * L, int idx)
+{
+    int type = lua_type(L, idx);
+
+    switch(type) {
+        case LUA_TSTRING: {
+            size_t len;
+            const char * s = lua_tolstring(L, idx, &len);
+            renderBytes(s, len, len);
+            break;
+        }
+        case LUA_TNUMBER: {
+            renderf("%.8f", lua_tonumber(L, idx));
+            break;
+        }
+        case LUA_TBOOLEAN: {
+            renderf("%s", lua_toboolean(L, idx) ? "true" : "false");
+            break;
+        }
+        case LUA_TNIL: {
+            renderf("nil");
+            break;
+        }
+        default: {
+            renderf("%p", lua_topointer(L, idx));
+            if (g_render.tostring && (type == LUA_TTABLE || type == LUA_TUSERDATA)
+                && renderBudget())
+                renderToString(L, idx);
+            break;
+        }
+    }
+}
+
+/*
+** A key-value pair is on top of L. L stays unchanged after call.
+*/
+static void printTabPair(lua_State * L, int leadingSp)
+{
+    renderf("%*s* KT(%s) \tKey(", leadingSp, "", typeName(lua_type(L, -2)));
+    renderValue(L, -2);
+    renderf(") \tVT(%s) \tVal(", typeName(lua_type(L, -1)));
+    renderValue(L, -1);
+    renderf(")\n");
+}
+
+/*
+** A table is on top of L. Entries come in lua_next() order, so that the
+** iteration ends as soon as the command budget is spent, however big the
+** table is. L stays unchanged after call.
+*/
+static void expandTable(lua_State * L, int level, int leadingSp)
+{
+    if (!level)
+        return;
+
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+        if (!renderBudget()) {
+            renderf("%*s...(more entries)\n", leadingSp, "");
+            lua_pop(L, 2);
+            return;
+        }
+        printTabPair(L, leadingSp);
+        if (lua_istable(L, -1))
+            expandTable(L, level - 1, leadingSp + 2);
+        lua_pop(L, 1);
+    }
+}
+
+/*
+** Variable value is on top of L. L stays unchanged after call.
+*/
+static void printVar(const char * name, lua_State * L, const char * scope, int tabLevel)
+{
+    if (scope)
+        renderf("Scope(%s) \t", scope);
+    renderf("Name(%s) \tType(%s) \tValue(", name, typeName(lua_type(L, -1)));
+    renderValue(L, -1);
+    renderf(")\n");
+    if (lua_istable(L, -1) && tabLevel > 0)
+        expandTable(L, tabLevel, 2);
+}
+
+void listLocals(lua_State * L, lua_Debug * ar, const Action * a)
+{
+    struct lua_Debug AR;
+    int level = a->argc ? a->num[0] : 1;
+    int i = 1;
+    const char * name;
+
+    if (level < 1)
+        level = 1;
+    if (--level > 0) {
+        if (!lua_getstack(L, level, &AR)) {
+            fprintf(g_out, "No local variable info available at stack level %d.\n", level + 1);
+            return;
+        }
+        ar = &AR;
+    }
+
+    fprintf(g_out, "Local Variables of Stack Level %d:>>>>>>>>\n", level + 1);
+    while ((name = lua_getlocal(L, ar, i++))) {
+        if (strcmp(name, "(*temporary)"))
+            printVar(name, L, NULL, 0);
+        lua_pop(L, 1);
+    }
+    fprintf(g_out, "<<<<<<<<\n");
+}
+
+void listUpVars(lua_State * L, lua_Debug * ar, const Action * a)
+{
+    struct lua_Debug AR;
+    int level = a->argc ? a->num[0] : 1;
+    int i = 1;
+    const char * name;
+
+    if (level < 1)
+        level = 1;
+    if (--level > 0) {
+        if (!lua_getstack(L, level, &AR)) {
+            fprintf(g_out, "No up-variable info available at stack level %d.\n", level + 1);
+            return;
+        }
+        ar = &AR;
+    }
+
+    if (lua_getinfo(L, "f", ar)) {
+        fprintf(g_out, "Up-Variables of Stack Level %d:>>>>>>>>\n", level + 1);
+        while ((name = lua_getupvalue(L, -1, i++))) {
+            printVar(name, L, NULL, 0);
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+        fprintf(g_out, "<<<<<<<<\n");
+    }
+}
+
+void printStack(lua_State * L)
+{
+    struct lua_Debug ar;
+    int i = 0;
+    fprintf(g_out, "Call Stack:>>>>>>>>\n");
+    while (lua_getstack(L, i, &ar)) {
+        lua_getinfo(L, "nSl", &ar);
+        printWhere(&ar, "");
+        i++;
+    }
+    fprintf(g_out, "<<<<<<<<\n");
+}
+
+/*
+** L stays unchanged after call.
+*/
+void watch(lua_State * L, lua_Debug * ar, const Action * a)
+{
+    const char * name = a->argv[0];
+    const char * p;
+    int tabLevel = 0;   //used only when the value being watched is a table
+    int i = 1;
+
+    if (a->argc > 1 && a->num[1] > 0)
+        tabLevel = a->num[1];
+
+    //check if it's a local var
+    lua_pushnil(L);
+    while ((p = lua_getlocal(L, ar, i++))) {
+        if (!strcmp(name, p))
+            lua_replace(L, -2);
+        else
+            lua_pop(L, 1);
+    }
+    if (!lua_isnil(L, -1)) {
+        printVar(name, L, "local", tabLevel);
+        lua_pop(L, 1);
+        return;
+    }
+
+    //check if it's an up-var
+    lua_getinfo(L, "f", ar);
+    i = 1;
+    while ((p = lua_getupvalue(L, -1, i++))) {
+        if (!strcmp(name, p))
+            lua_replace(L, -3);
+        else
+            lua_pop(L, 1);
+    }
+    if (!lua_isnil(L, -2)) {
+        lua_pop(L, 1);
+        printVar(name, L, "up", tabLevel);
+        lua_pop(L, 1);
+        return;
+    }
+    lua_remove(L, -2);
+
+    //check if it's a global, without running an __index on a paused coroutine
+    lua_getfenv(L, -1);
+    if (lua_status(L) == LUA_YIELD) {
+        lua_pushstring(L, name);
+        lua_rawget(L, -2);
+    }
+    else
+        lua_getfield(L, -1, name);
+    if (!lua_isnil(L, -1)) {
+        printVar(name, L, "global", tabLevel);
+        lua_pop(L, 3);
+        return;
+    }
+
+    lua_pop(L, 3);
+    fprintf(g_out, "Variable(%s) is not defined!\n", name);
+}
+
+/*
+** Lua 5.1 can't run Lua code on a coroutine paused by poll(): the VM sees
+** its LUA_YIELD status and returns at once, leaving a broken call frame
+** behind. The script then runs in a new thread, which shares the globals
+** of L and has no hook.
+** L stays unchanged after call.
+*/
+void exec(lua_State * L, const Action * a)
+{
+    lua_State * co = L;
+
+    if (lua_status(L) == LUA_YIELD) {
+        co = lua_newthread(L);
+        lua_sethook(co, NULL, 0, 0);
+    }
+    if (luaL_loadstring(co, a->rest) || lua_pcall(co, 0, 0, 0)) {
+        fprintf(g_out, "%s\n", lua_tostring(co, -1));
+        lua_pop(co, 1);
+    }
+    if (co != L)
+        lua_pop(L, 1);
+}
+
+/*
+** Get the full path of the file named by a breakpoint command, where "."
+** stands for src, the file stopped in. Return 0 if there's no such file.
+*/
+static int breakPointPath(const char * src, const char * file, char * path)
+{
+    if (!strcmp(file, "."))
+        file = src;
+    return file && fullPath(file, path) && !_access(path, 0);
+}
+
+/*
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+void setBreakPoint(lua_State * L, const char * src, const Action * a, int del)
+{
+    char path[_MAX_PATH + 1];
+    int line = a->num[1];
+
+    if (line <= 0) {
+        fprintf(g_out, "Invalid argument!\n");
+        return;
+    }
+    if (!breakPointPath(src, a->argv[0], path)) {
+        fprintf(g_out, "Invalid path!\n");
+        return;
+    }
+    toggleBreakPoint(L, path, line, del);
+}
+
+/*
+** Set or delete the breakpoint at line of the file at the full path.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+static void toggleBreakPoint(lua_State * L, const char * path, int line, int del)
+{
+
+    lua_pushliteral(L, "breakpoints");
+    lua_rawget(L, -2);
+    lua_pushstring(L, path);
+    lua_rawget(L, -2);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushstring(L, path);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, -4);
+    }
+    if (del)
+        lua_pushnil(L);
+    else
+        lua_pushboolean(L, 1);
+    lua_rawseti(L, -2, line);
+
+    if (del) { //check if the path table is empty
+        lua_pushnil(L);
+        if (!lua_next(L, -2)) { //remove the entry from breakpoints table if it's empty
+            lua_pushstring(L, path);
+            lua_pushnil(L);
+            lua_rawset(L, -4);
+        }
+        else
+            lua_pop(L, 2);
+    }
+    lua_pop(L, 2);
+}
+
+/*
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+void setFuncBreakPoint(lua_State * L, const Action * a, int del)
+{
+    lua_pushliteral(L, "funcbreakpoints");
+    lua_rawget(L, -2);
+    lua_pushstring(L, a->argv[0]);
+    if (del)
+        lua_pushnil(L);
+    else
+        lua_pushboolean(L, 1);
+    lua_rawset(L, -3);
+
+    //drop resolved functions, or the whole index if no pattern is left
+    lua_pushliteral(L, "funcindex");
+    lua_pushnil(L);
+    if (!lua_next(L, -3)) {
+        lua_pushnil(L);
+    }
+    else {
+        lua_pop(L, 2);
+        lua_newtable(L);
+        lua_newtable(L);
+        lua_pushliteral(L, "__mode");
+        lua_pushliteral(L, "k");
+        lua_rawset(L, -3);
+        lua_setmetatable(L, -2);
+    }
+    lua_rawset(L, -4);
+    lua_pop(L, 1);
+}
+
+/*
+** Given a table on top of L, it sorts the keys of that table and stores
+** the sorted keys in a new table returned on top of L. Thus L increases by 1.
+** Return the length of the new table.
+*/
+int sortKey(lua_State * L)
+{
+    int i = 1;
+    lua_newtable(L);
+    lua_pushnil(L);
+    while (lua_next(L, -3)) {
+        lua_pushvalue(L, -2);
+        lua_rawseti(L, -4, i++);
+        lua_pop(L, 1);
+    }
+
+    lua_getglobal(L, "table");
+    lua_getfield(L, -1, "sort");
+    lua_pushvalue(L, -3);
+    lua_call(L, 1, 0);
+    lua_pop(L, 1);
+    return i - 1;
+}
+
+/*
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
+*/
+void listBreakPoints(lua_State * L)
+{
+    int i, n;
+    int top = lua_gettop(L);
+
+    lua_pushliteral(L, "breakpoints");
+    lua_rawget(L, -2);
+    n = sortKey(L);
+
+    fprintf(g_out, "Break Points:>>>>>>>>\n");
+    for (i = 1; i <= n; i++) {
+        int j, m;
+        const char * path;
+
+        lua_rawgeti(L, -1, i);
+        path = lua_tostring(L, -1);
+        lua_rawget(L, -3);
+        assert(lua_istable(L, -1));
+
+        m = sortKey(L);
+        for (j = 1; j <= m; j++) {
+            lua_rawgeti(L, -1, j);
+            fprintf(g_out, "File %s Line %d\n", path, (int)lua_tointeger(L, -1));
+            lua_pop(L, 1);
         }
-        case LUA_TLIGHTUSERDATA: {
-            printf("VT(light userdata) \tVal(%08X)\n", lua_topointer(L, -1));
+        lua_pop(L, 2);
+    }
+    lua_pop(L, 2);
+
+    lua_pushliteral(L, "funcbreakpoints");
+    lua_rawget(L, -2);
+    n = sortKey(L);
+    for (i = 1; i <= n; i++) {
+        lua_rawgeti(L, -1, i);
+        fprintf(g_out, "Function %s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 2);
+    fprintf(g_out, "<<<<<<<<\n");
+    assert(top == lua_gettop(L));
+}
+
+/*
+** Size of the value entry at p.
+*/
+static size_t recEntrySize(const unsigned char * p)
+{
+    size_t size = 3 + p[2];
+    const unsigned char * payload = p + size;
+
+    switch (p[1]) {
+        case LUA_TNUMBER:
+            return size + sizeof(lua_Number);
+        case LUA_TBOOLEAN:
+            return size + 1;
+        case LUA_TSTRING:
+            return size + 5 + payload[4];
+        case LUA_TNIL:
+            return size;
+        default:
+            return size + sizeof(void *);
+    }
+}
+
+static void recPrintEntry(const unsigned char * p)
+{
+    const unsigned char * payload = p + 3 + p[2];
+
+    fprintf(g_out, "Name(%.*s) \t", (int)p[2], (const char *)p + 3);
+    switch (p[1]) {
+        case LUA_TNUMBER: {
+            lua_Number n;
+            memcpy(&n, payload, sizeof(n));
+            fprintf(g_out, "Type(number) \tValue(%.8f)\n", n);
             break;
         }
         case LUA_TBOOLEAN: {
-            printf("VT(boolean) \tVal(%s)\n", lua_toboolean(L, -1) ? "true" : "false");
+            fprintf(g_out, "Type(boolean) \tValue(%s)\n", *payload ? "true" : "false");
             break;
         }
-        case LUA_TTHREAD: {
-            printf("VT(thread) \tVal(%08X)\n", lua_topointer(L, -1));
+        case LUA_TSTRING: {
+            unsigned int total;
+            memcpy(&total, payload, 4);
+            fprintf(g_out, "Type(string) \tValue(");
+            renderBytes((const char *)payload + 5, payload[4], total);
+            fprintf(g_out, ")\n");
             break;
         }
         case LUA_TNIL: {
-            printf("VT(nil) \tVal(nil)\n");
+            fprintf(g_out, "Type(nil) \tValue(nil)\n");
+            break;
+        }
+        default: {
+            const void * ptr;
+            memcpy(&ptr, payload, sizeof(ptr));
+            fprintf(g_out, "Type(%s) \tValue(%p)\n", typeName(p[1]), ptr);
+            break;
+        }
+    }
+}
+
+/*
+** Average time spent in recordLine() per line event, in nanoseconds.
+*/
+static double recOverhead()
+{
+    LARGE_INTEGER freq;
+
+    if (!g_rec.lines)
+        return 0;
+    QueryPerformanceFrequency(&freq);
+    return (double)g_rec.ticks * 1e9 / (double)freq.QuadPart / g_rec.lines;
+}
+
+/*
+** Print the event with sequence number seq and the locals rebuilt at it.
+*/
+static void recShow(unsigned long seq)
+{
+    const unsigned char * slots[REC_MAX_SLOTS + 1];
+    size_t pos = g_rec.head;
+    int complete = 0;
+    unsigned long n;
+    RecEvent ev;
+    RecFunc * f;
+    int i;
+
+    memset(slots, 0, sizeof(slots));
+    for (n = 0; n < g_rec.count; n++) {
+        const unsigned char * p = g_rec.arena + pos;
+
+        memcpy(&ev, p, sizeof(ev));
+        if (ev.flags & REC_FULL) {
+            memset(slots, 0, sizeof(slots));
+            complete = 1;
+        }
+        p += sizeof(ev);
+        for (i = 0; i < ev.nvals; i++) {
+            slots[p[0]] = p;
+            p += recEntrySize(p);
+        }
+        if (ev.seq == seq)
             break;
+        pos = recAdvance(pos, ev.size);
+    }
+
+    f = &g_rec.funcs[ev.fid];
+    fprintf(g_out, "History #%lu (%lu back) \t%s \tLine:%d \tName:%s\n", seq, g_rec.seq - seq,
+        f->src, ev.line, f->name);
+    fprintf(g_out, "Local Variables:>>>>>>>>\n");
+    for (i = 1; i <= ev.nslots; i++) {
+        if (slots[i])
+            recPrintEntry(slots[i]);
+    }
+    if (!complete)
+        fprintf(g_out, "(Earlier values have been dropped from the log.)\n");
+    fprintf(g_out, "<<<<<<<<\n");
+}
+
+/*
+** Move the history cursor n events back and show the event there.
+*/
+void rewindHistory(int n)
+{
+    unsigned long first = g_rec.seq - g_rec.count + 1;
+
+    if (!g_rec.arena || !g_rec.count) {
+        fprintf(g_out, "Nothing recorded!\n");
+        return;
+    }
+    if (g_rec.cursor <= first && n > 0) {
+        fprintf(g_out, "No earlier event recorded.\n");
+        return;
+    }
+    if (n <= 0)
+        g_rec.cursor = g_rec.seq;
+    else if (g_rec.cursor - first < (unsigned long)n)
+        g_rec.cursor = first;
+    else
+        g_rec.cursor -= n;
+    recShow(g_rec.cursor);
+}
+
+/*
+** Print every recorded change of the local variable name.
+*/
+void varHistory(const char * name)
+{
+    size_t len = strlen(name);
+    const unsigned char * last = NULL;
+    size_t lastSize = 0;
+    int lastFid = -1;
+    size_t pos = g_rec.head;
+    unsigned long n;
+
+    if (!g_rec.arena) {
+        fprintf(g_out, "Nothing recorded!\n");
+        return;
+    }
+    fprintf(g_out, "History of %s:>>>>>>>>\n", name);
+    for (n = 0; n < g_rec.count; n++) {
+        const unsigned char * p = g_rec.arena + pos;
+        RecEvent ev;
+        int i;
+
+        memcpy(&ev, p, sizeof(ev));
+        p += sizeof(ev);
+        for (i = 0; i < ev.nvals; i++) {
+            size_t size = recEntrySize(p);
+
+            //full snapshots log unchanged values again, skip those
+            if (p[2] == len && !memcmp(p + 3, name, len) && (lastFid != ev.fid
+                || size != lastSize || memcmp(last, p, size))) {
+                fprintf(g_out, "#%lu \t%s \tLine:%d \t", ev.seq, g_rec.funcs[ev.fid].src, ev.line);
+                recPrintEntry(p);
+                last = p;
+                lastSize = size;
+                lastFid = ev.fid;
+            }
+            p += size;
+        }
+        pos = recAdvance(pos, ev.size);
+    }
+    fprintf(g_out, "<<<<<<<<\n");
+}
+
+/*
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+void record(lua_State * L, const Action * a)
+{
+    if (!a->argc) {
+        if (!g_rec.arena) {
+            fprintf(g_out, "Not recording.\n");
+            return;
+        }
+        fprintf(g_out, "Recording(%s) \tEvents(%lu) \tDropped(%lu) \tArena(%lu/%lu bytes) \tOverhead(%.1f ns/event)\n",
+            g_rec.filter, g_rec.count, g_rec.evicted,
+            (unsigned long)(g_rec.wrapped ? g_rec.wrap - g_rec.head + g_rec.tail : g_rec.tail - g_rec.head),
+            (unsigned long)g_rec.cap, recOverhead());
+        return;
+    }
+    if (!_stricmp(a->argv[0], "off")) {
+        stopRecording(L);
+        return;
+    }
+    if (!startRecording(L, a->argv[0], a->argc > 1 ? a->num[1] : 0))
+        fprintf(g_out, "Out of memory!\n");
+}
+
+/*
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+void profile(lua_State * L, const Action * a)
+{
+    const char * arg = a->argv[0];
+
+    if (!a->argc) {
+        fprintf(g_out, "Profiling(%s%s) \tLine events(%lu)\n", g_heat.on ? "on" : "off",
+            g_heat.on && g_heat.timing ? ", timed" : "", g_heat.total);
+        return;
+    }
+    if (!_stricmp(arg, "on")) {
+        g_heat.on = 1;
+        g_heat.timing = a->argc > 1 && !_stricmp(a->argv[1], "time");
+        g_heat.last = NULL;
+        g_heat.frame = NULL; //calls may have gone unseen while off
+        lua_sethook(L, hook, LUA_MASKLINE | LUA_MASKCALL | LUA_MASKRET, 0);
+    }
+    else if (!_stricmp(arg, "off")) {
+        g_heat.on = 0;
+    }
+    else if (!_stricmp(arg, "reset")) {
+        resetProfile(L);
+    }
+    else
+        fprintf(g_out, "Invalid argument!\n");
+}
+
+/*
+** Milliseconds in ticks of the performance counter.
+*/
+static double ticksToMs(LONGLONG ticks)
+{
+    LARGE_INTEGER freq;
+
+    QueryPerformanceFrequency(&freq);
+    return (double)ticks * 1000.0 / (double)freq.QuadPart;
+}
+
+static unsigned long chunkTotal(HeatChunk * c, int * hottest)
+{
+    unsigned long total = 0;
+    int i;
+
+    *hottest = 0;
+    for (i = 0; i < c->size; i++) {
+        total += c->counts[i];
+        if (c->counts[i] > c->counts[*hottest])
+            *hottest = i;
+    }
+    return total;
+}
+
+/*
+** Print count, share of all line events and time of a line.
+*/
+static void printHeat(HeatChunk * c, int line)
+{
+    unsigned long count = line < c->size ? c->counts[line] : 0;
+
+    if (!count) {
+        fprintf(g_out, "%10s %7s ", "", "");
+        if (g_heat.timing)
+            fprintf(g_out, "%12s ", "");
+        return;
+    }
+    fprintf(g_out, "%10lu %6.2f%% ", count, 100.0 * count / g_heat.total);
+    if (g_heat.timing)
+        fprintf(g_out, "%10.3fms ", ticksToMs(c->ticks[line]));
+}
+
+/*
+** Print the source of a file chunk annotated with its line counts. Lines of
+** other chunks are printed without text.
+*/
+static void annotate(HeatChunk * c)
+{
+    FILE * f = c->path[0] ? fopen(c->path, "r") : NULL;
+    int line = 0;
+
+    fprintf(g_out, "Heatmap of %s:>>>>>>>>\n", c->path[0] ? c->path : c->source);
+    if (f) {
+        char buf[CMD_LINE];
+
+        while (fgets(buf, CMD_LINE, f)) {
+            size_t len = strlen(buf);
+
+            if (len && buf[len - 1] == '\n')
+                buf[--len] = 0;
+            else { //skip the rest of a long line
+                int ch;
+                while ((ch = fgetc(f)) != EOF && ch != '\n');
+            }
+            printHeat(c, ++line);
+            fprintf(g_out, "%5d: %s\n", line, buf);
+        }
+        fclose(f);
+    }
+    for (line++; line < c->size; line++) {
+        if (c->counts[line]) {
+            printHeat(c, line);
+            fprintf(g_out, "%5d:\n", line);
+        }
+    }
+    fprintf(g_out, "<<<<<<<<\n");
+}
+
+/*
+** Write the profile in lcov tracefile format, which editor coverage plugins
+** can show as a gutter overlay. Only file chunks are written, and only the
+** lines that ran: the profiler never learns which other lines hold code, so
+** LF equals LH. The file carries hit counts, it isn't a coverage report.
+*/
+static void exportHeatmap(const char * out)
+{
+    FILE * f = fopen(out, "w");
+    HeatChunk * c;
+    int line;
+
+    if (!f) {
+        fprintf(g_out, "Can't open %s!\n", out);
+        return;
+    }
+    fprintf(f, "TN:heatmap\n");
+    for (c = g_heat.chunks; c; c = c->next) {
+        int hit = 0;
+
+        if (!c->path[0])
+            continue;
+        fprintf(f, "SF:%s\n", c->path);
+        for (line = 1; line < c->size; line++) {
+            if (c->counts[line]) {
+                fprintf(f, "DA:%d,%lu\n", line, c->counts[line]);
+                hit++;
+            }
+        }
+        fprintf(f, "LH:%d\nLF:%d\nend_of_record\n", hit, hit);
+    }
+    fclose(f);
+    fprintf(g_out, "Heatmap written to %s.\n", out);
+}
+
+void heatmap(const char * src, const Action * a)
+{
+    const char * arg = a->argv[0];
+    char path[_MAX_PATH + 1];
+    HeatChunk * c;
+
+    if (!g_heat.chunks) {
+        fprintf(g_out, "Nothing profiled!\n");
+        return;
+    }
+    if (!a->argc) {
+        fprintf(g_out, "Heatmap:>>>>>>>>\n");
+        for (c = g_heat.chunks; c; c = c->next) {
+            int hottest;
+            unsigned long total;
+
+            if (!c->size)
+                continue;
+            total = chunkTotal(c, &hottest);
+
+            fprintf(g_out, "%10lu %6.2f%% \tHottest line %d(%lu) \t%s\n", total,
+                100.0 * total / g_heat.total, hottest, c->counts[hottest],
+                c->path[0] ? c->path : c->source);
+        }
+        fprintf(g_out, "<<<<<<<<\n");
+        return;
+    }
+    if (!_stricmp(arg, "export")) {
+        if (a->argc > 1)
+            exportHeatmap(a->argv[1]);
+        else
+            fprintf(g_out, "Invalid argument!\n");
+        return;
+    }
+
+    if (!strcmp(arg, "."))
+        arg = src;
+    if (!arg || !fullPath(arg, path)) {
+        fprintf(g_out, "Invalid path!\n");
+        return;
+    }
+    for (c = g_heat.chunks; c; c = c->next) {
+        if (!strcmp(c->path, path) || !strcmp(c->source, arg)) {
+            annotate(c);
+            return;
         }
     }
+    fprintf(g_out, "No line of %s has run!\n", arg);
+}
+
+void setOption(const Action * a)
+{
+    const char * name = a->argv[0];
+    const char * value = a->argv[1];
+    long n = a->num[1];
+
+    if (!a->argc) {
+        fprintf(g_out, "valueBudget(%lu) \tcommandBudget(%lu) \ttostring(%s) \ttimeout(%lu ms)\n",
+            (unsigned long)g_render.valueBudget, (unsigned long)g_render.commandBudget,
+            g_render.tostring ? "on" : "off", (unsigned long)g_render.timeout);
+        return;
+    }
+    if (a->argc < 2) {
+        fprintf(g_out, "Invalid argument!\n");
+        return;
+    }
+
+    if (!_stricmp(name, "valueBudget") && n > 0)
+        g_render.valueBudget = n;
+    else if (!_stricmp(name, "commandBudget") && n > 0)
+        g_render.commandBudget = n;
+    else if (!_stricmp(name, "tostring"))
+        g_render.tostring = !_stricmp(value, "on");
+    else if (!_stricmp(name, "timeout") && n > 0)
+        g_render.timeout = n;
+    else
+        fprintf(g_out, "Invalid argument!\n");
+}
+
+/*
+** Get the paused-thread table of the "debugger" table onto the top of L.
+*/
+static void pushPaused(lua_State * L)
+{
+    lua_pushliteral(L, "debugger");
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    lua_pushliteral(L, "paused");
+    lua_rawget(L, -2);
+    lua_remove(L, -2);
+}
+
+/*
+** debugger.setAsync(flag)
+*/
+int apiSetAsync(lua_State * L)
+{
+    luaL_checkany(L, 1);
+    lua_pushliteral(L, "debugger");
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    lua_pushliteral(L, "async");
+    lua_pushboolean(L, lua_toboolean(L, 1));
+    lua_rawset(L, -3);
+    return 0;
+}
+
+/*
+** debugger.status(co) returns "debug-paused" if co is stopped by the
+** debugger, otherwise nil.
+*/
+int apiStatus(lua_State * L)
+{
+    luaL_checktype(L, 1, LUA_TTHREAD);
+    pushPaused(L);
+    lua_pushvalue(L, 1);
+    lua_rawget(L, -2);
+    if (lua_isnil(L, -1))
+        return 1;
+    lua_pushliteral(L, "debug-paused");
+    return 1;
+}
+
+/*
+** debugger.post(co, line) queues a command line for a paused coroutine.
+** Returns false if co isn't paused.
+*/
+int apiPost(lua_State * L)
+{
+    luaL_checktype(L, 1, LUA_TTHREAD);
+    luaL_checkstring(L, 2);
+    pushPaused(L);
+    lua_pushvalue(L, 1);
+    lua_rawget(L, -2);
+    if (lua_isnil(L, -1)) {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+    lua_pushvalue(L, 2);
+    lua_rawseti(L, -2, lua_objlen(L, -2) + 1);
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+/*
+** debugger.poll(co) runs the commands queued for co without blocking.
+** Returns "resumed" when a resuming command was taken and the host should
+** resume co, "debug-paused" when co is still waiting for commands, or nil
+** if co isn't paused at all.
+*/
+int apiPoll(lua_State * L)
+{
+    lua_State * co;
+    lua_Debug ar;
+    int cmd = 0;
+    int mask;
+    int i, n;
+
+    luaL_checktype(L, 1, LUA_TTHREAD);
+    co = lua_tothread(L, 1);
+    lua_settop(L, 1);
+    pushPaused(L);
+    lua_pushvalue(L, 1);
+    lua_rawget(L, 2);
+    if (lua_isnil(L, 3))
+        return 1;
+    if (!lua_getstack(co, 0, &ar))
+        return luaL_error(L, "no active function in paused thread");
+    lua_getinfo(co, "nSl", &ar);
+
+    n = lua_objlen(L, 3);
+    lua_checkstack(co, LUA_MINSTACK);
+    lua_pushliteral(co, "debugger");
+    lua_rawget(co, LUA_REGISTRYINDEX);
+    ChangeTextColor();
+    g_inCommand = 1;
+    for (i = 1; i <= n && !cmd; i++) {
+        lua_rawgeti(L, 3, i);
+        fprintf(g_out, "?>%s\n", lua_tostring(L, -1));
+        cmd = doCommand(co, &ar, lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+    g_inCommand = 0;
+    RestoreTextColor();
+    lua_pop(co, 1);
+
+    lua_pushvalue(L, 1);
+    if (cmd) {
+        lua_pushnil(L);
+        lua_rawset(L, 2);
+
+        //skip the line event repeated on resume, see resumedEvent()
+        mask = lua_gethookmask(co);
+        lua_pushliteral(L, "debugger");
+        lua_rawget(L, LUA_REGISTRYINDEX);
+        lua_pushliteral(L, "resuming");
+        lua_rawget(L, -2);
+        lua_pushvalue(L, 1);
+        lua_rawget(L, -2);
+        if (lua_isnil(L, -1) && mask)
+            g_resuming++;
+        else if (!lua_isnil(L, -1) && !mask)
+            g_resuming--;
+        lua_pop(L, 1);
+        lua_pushvalue(L, 1);
+        if (mask) {
+            lua_pushinteger(L, 0);
+            lua_sethook(co, hook, mask | LUA_MASKCOUNT, 1);
+        }
+        else
+            lua_pushnil(L);
+        lua_rawset(L, -3);
+        lua_pop(L, 2);
+        lua_pushliteral(L, "resumed");
+        return 1;
+    }
+
+    //keep the commands that haven't been run yet
+    lua_newtable(L);
+    for (n = 1; i <= (int)lua_objlen(L, 3); i++, n++) {
+        lua_rawgeti(L, 3, i);
+        lua_rawseti(L, -2, n);
+    }
+    lua_rawset(L, 2);
+    lua_pushliteral(L, "debug-paused");
+    return 1;
 }
 
 /*
-** A table is on top of L. L stays unchanged after call.
+** debugger.record(filter[, kbytes]) starts recording, debugger.record(false)
+** stops it.
 */
-static void expandTable(lua_State * L, int level, int leadingSp)
+int apiRecord(lua_State * L)
 {
-    int n;
-    int i;
-    if (!level)
-        return;
-
-    n = sortKey(L);
-    for (i = 1; i <= n; i++) {
-        lua_rawgeti(L, -1, i);
-        lua_pushvalue(L, -1);
-        lua_gettable(L, -4);
-        printTabPair(L, leadingSp);
-        if (lua_istable(L, -1)) {
-            expandTable(L, level - 1, leadingSp + 2);
-        }
-        lua_pop(L, 2);
+    lua_pushliteral(L, "debugger");
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    if (!lua_toboolean(L, 1)) {
+        stopRecording(L);
+        return 0;
     }
-    lua_pop(L, 1);
+    if (!startRecording(L, luaL_checkstring(L, 1), luaL_optint(L, 2, 0)))
+        return luaL_error(L, "not enough memory");
+    return 0;
 }
 
 /*
-** Variable value is on top of L. L stays unchanged after call.
+** debugger.recordStats() returns the number of events kept, the number of
+** events dropped and the average recording time per line event in ns.
 */
-static void printVar(const char * name, lua_State * L, const char * scope, int tabLevel)
+int apiRecordStats(lua_State * L)
 {
-    int type;
-    type = lua_type(L, -1);
-
-    if (scope)
-        printf("Scope(%s) \t", scope);
-    printf("Name(%s) \t", name);
-
-    switch(type) {
-        case LUA_TSTRING: {
-            printf("Type(string) \tValue(%s)\n", lua_tostring(L, -1));
-            break;
-        }
-        case LUA_TNUMBER: {
-            printf("Type(number) \tValue(%.8f)\n", lua_tonumber(L, -1));
-            break;
-        }
-        case LUA_TTABLE: {
-            printf("Type(table) \tValue(%08X)\n", lua_topointer(L, -1));
-            if (tabLevel > 0) {
-                expandTable(L, tabLevel, 2);
-            }
-            break;
-        }
-        case LUA_TFUNCTION: {
-            printf("Type(function) \tValue(%08X)\n", lua_topointer(L, -1));
-            break;
-        }
-        case LUA_TUSERDATA: {
-            printf("Type(userdata) \tValue(%08X)\n", lua_topointer(L, -1));
-            break;
-        }
-        case LUA_TLIGHTUSERDATA: {
-            printf("Type(light userdata) \tValue(%08X)\n", lua_topointer(L, -1));
-            break;
-        }
-        case LUA_TBOOLEAN: {
-            printf("Type(boolean) \tValue(%s)\n", lua_toboolean(L, -1) ? "true" : "false");
-            break;
-        }
-        case LUA_TTHREAD: {
-            printf("Type(thread) \tValue(%08X)\n", lua_topointer(L, -1));
-            break;
-        }
-        case LUA_TNIL: {
-            printf("Type(nil) \tValue(nil)\n");
-            break;
-        }
-    }
+    lua_pushinteger(L, g_rec.count);
+    lua_pushinteger(L, g_rec.evicted);
+    lua_pushnumber(L, recOverhead());
+    return 3;
 }
 
-void listLocals(lua_State * L, lua_Debug * ar, char * p, char * end)
+/*
+** Run the actions of a batch stop, or the "onstop" actions if the stop has
+** none. The debuggee runs on unless an action resumed it otherwise.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+void batchStop(lua_State * L, lua_Debug * ar)
 {
-    struct lua_Debug AR;
-    int level = -1;
-    int i = 1;
-    const char * name;
+    const Action * a = g_batch.onstop;
+    BatchStop * s;
+    int cmd = 0;
 
-    if (p < end && (p = parseOneArg(p, end, NULL))) {
-        level = strtol(p, NULL, 10);
-    }
-    if (level < 1)
-        level = 1;
-    if (--level > 0) {
-        if (!lua_getstack(L, level, &AR)) {
-            printf("No local variable info available at stack level %d.\n", level + 1);
-            return;
+    lua_getinfo(L, "nSl", ar);
+    pushChunkPath(L, ar);
+    if (lua_isstring(L, -1)) {
+        for (s = g_batch.stops; s; s = s->next) {
+            if (s->line == ar->currentline && !strcmp(s->path, lua_tostring(L, -1))) {
+                a = s->actions;
+                break;
+            }
         }
-        ar = &AR;
     }
+    lua_pop(L, 1);
 
-    printf("Local Variables of Stack Level %d:>>>>>>>>\n", level + 1);
-    while ((name = lua_getlocal(L, ar, i++))) {
-        if (strcmp(name, "(*temporary)"))
-            printVar(name, L, NULL, 0);
-        lua_pop(L, 1);
-    }
-    printf("<<<<<<<<\n");
+    printWhere(ar, "");
+    for (; a && !cmd; a = a->next)
+        cmd = runAction(L, ar, a);
+    if (!cmd)
+        runAction(L, ar, &g_runAction);
+    fflush(g_out);
 }
 
-void listUpVars(lua_State * L, lua_Debug * ar, char * p, char * end)
+static void appendAction(Action ** list, Action * a)
 {
-    struct lua_Debug AR;
-    int level = -1;
-    int i = 1;
-    const char * name;
-
-    if (p < end && (p = parseOneArg(p, end, NULL))) {
-        level = strtol(p, NULL, 10);
-    }
-    if (level < 1)
-        level = 1;
-    if (--level > 0) {
-        if (!lua_getstack(L, level, &AR)) {
-            printf("No up-variable info available at stack level %d.\n", level + 1);
-            return;
-        }
-        ar = &AR;
-    }
-
-    if (lua_getinfo(L, "f", ar)) {
-        printf("Up-Variables of Stack Level %d:>>>>>>>>\n", level + 1);
-        while ((name = lua_getupvalue(L, -1, i++))) {
-            printVar(name, L, NULL, 0);
-            lua_pop(L, 1);
-        }
-        lua_pop(L, 1);
-        printf("<<<<<<<<\n");
-    }
+    while (*list)
+        list = &(*list)->next;
+    *list = a;
 }
 
-void printStack(lua_State * L)
+static void freeActions(Action * a)
 {
-    struct lua_Debug ar;
-    int i = 0;
-    printf("Call Stack:>>>>>>>>\n");
-    while (lua_getstack(L, i, &ar)) {
-        lua_getinfo(L, "nSl", &ar);
-        printf("%s \tLine:%d \tName:%s \tWhat:%s\n", ar.short_src, ar.currentline,
-            ar.name ? ar.name : "(N/A)", *ar.what ? ar.what : "(N/A)");
-        i++;
+    while (a) {
+        Action * next = a->next;
+        free(a);
+        a = next;
     }
-    printf("<<<<<<<<\n");
 }
 
 /*
-** L stays unchanged after call.
+** A batch script compiled but not applied yet, so that a bad line leaves
+** the debugger as it was.
 */
-void watch(lua_State * L, lua_Debug * ar, char * p, char * end)
+typedef struct Script {
+    Action * commands;      //run when applied
+    Action * onstop;
+    BatchStop * stops;
+} Script;
+
+static void freeScript(Script * sc)
 {
-    char * name;
-    int tabLevel = 0;   //used only when the value being watched is a table
-    int i = 1;
+    BatchStop * s = sc->stops;
 
-    if (p >= end || !(name = parseOneArg(p, end, &p))) {
-        printf("Invalid argument!\n");
-        return;
-    }
-    if (++p < end && (p = parseOneArg(p, end, NULL))) {
-        tabLevel = strtol(p, NULL, 10);
-        if (tabLevel < 0)
-            tabLevel = 0;
+    while (s) {
+        BatchStop * next = s->next;
+        freeActions(s->actions);
+        free(s);
+        s = next;
     }
+    freeActions(sc->commands);
+    freeActions(sc->onstop);
+}
 
-    //check if it's a local var
-    lua_pushnil(L);
-    while ((p = (char *)lua_getlocal(L, ar, i++))) {
-        if (!strcmp(name, p))
-            lua_replace(L, -2);
-        else
-            lua_pop(L, 1);
-    }
-    if (!lua_isnil(L, -1)) {
-        printVar(name, L, "local", tabLevel);
-        lua_pop(L, 1);
-        return;
-    }
+/*
+** Read a whole line of f into *buf, growing it as needed. Return 1 if a line
+** has been read, 0 at the end of the file and -1 when out of memory.
+*/
+static int readLine(FILE * f, char ** buf, size_t * size)
+{
+    size_t len = 0;
 
-    //check if it's an up-var
-    lua_getinfo(L, "f", ar);
-    i = 1;
-    while ((p = (char *)lua_getupvalue(L, -1, i++))) {
-        if (!strcmp(name, p))
-            lua_replace(L, -3);
-        else
-            lua_pop(L, 1);
-    }
-    if (!lua_isnil(L, -2)) {
-        lua_pop(L, 1);
-        printVar(name, L, "up", tabLevel);
-        lua_pop(L, 1);
-        return;
-    }
-    lua_remove(L, -2);
+    for (;;) {
+        if (*size - len < 2) {
+            char * p = realloc(*buf, *size ? *size * 2 : CMD_LINE);
 
-    //check if it's a global
-    lua_getfenv(L, -1);
-    lua_getfield(L, -1, name);
-    if (!lua_isnil(L, -1)) {
-        printVar(name, L, "global", tabLevel);
-        lua_pop(L, 3);
-        return;
+            if (!p)
+                return -1;
+            *buf = p;
+            *size = *size ? *size * 2 : CMD_LINE;
+        }
+        if (!fgets(*buf + len, (int)(*size - len), f))
+            return len > 0;
+        len += strlen(*buf + len);
+        if ((*buf)[len - 1] == '\n')
+            return 1;
     }
-
-    lua_pop(L, 3);
-    printf("Variable(%s) is not defined!\n", name);
 }
 
 /*
-** L stays unchanged after call.
+** Return what follows word if line starts with it, otherwise NULL.
 */
-void exec(lua_State * L, lua_Debug * ar, char * p, char * end)
+static char * scriptKeyword(char * line, const char * word)
 {
-    if (p >= end) {
-        printf("Invalid argument!\n");
-        return;
-    }
-    if (luaL_loadstring(L, p)) {
-        printf("%s\n", lua_tostring(L, -1));
-        lua_pop(L, 1);
-    }
+    size_t len = strlen(word);
 
-    if (lua_pcall(L, 0, 0, 0)) {
-        printf("%s\n", lua_tostring(L, -1));
-        lua_pop(L, 1);
-    }
+    if (_strnicmp(line, word, len) || !isspace((unsigned char)line[len]))
+        return NULL;
+    return line + len;
 }
 
 /*
-** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
-** unchanged after call, but the "debugger" table may be changed.
+** Compile one line of a batch script into sc. Return an error message, or
+** NULL.
 */
-void setBreakPoint(lua_State * L, const char * src, char * p, char * end, int del)
+static const char * scriptLine(Script * sc, char * line)
 {
-    int line;
-    char * pFile;
-    char * pLine;
-    char path[_MAX_PATH + 1];
+    char * end = line + strlen(line);
+    char * p = line + strspn(line, " \t\r\n");
+    char * rest;
+    Action * a;
 
-    if (p >= end || !(pFile = parseOneArg(p, end, &p))
-        || ++p >= end || !(pLine = parseOneArg(p, end, &p))
-        || (line = strtol(pLine, NULL, 10)) <= 0) {
-        printf("Invalid argument!\n");
-        return;
-    }
+    if (!*p || *p == '#')
+        return NULL;
 
-    if (!strcmp(pFile, ".")) {
-        pFile = (char *)src;
-    }
-    if (!_fullpath(path, pFile, _MAX_PATH) || _access(path, 0)) {
-        printf("Invalid path!\n");
-        return;
+    if ((rest = scriptKeyword(p, "onstop"))) {
+        if (!(a = compileCommand(rest)))
+            return "invalid command";
+        appendAction(&sc->onstop, a);
     }
-#ifndef PATH_CASE_SENSITIVE
-    _strlwr(path);
-#endif
-
-    lua_pushliteral(L, "breakpoints");
-    lua_rawget(L, -2);
-    lua_pushstring(L, path);
-    lua_rawget(L, -2);
-    if (lua_isnil(L, -1)) {
-        lua_pop(L, 1);
-        lua_newtable(L);
-        lua_pushstring(L, path);
-        lua_pushvalue(L, -2);
-        lua_rawset(L, -4);
+    else if ((rest = scriptKeyword(p, "on"))) {
+        char path[_MAX_PATH + 1];
+        char * file;
+        char * pLine;
+        int line;
+        BatchStop * s;
+
+        if (!(file = parseOneArg(rest, end, &p)) || ++p >= end || !(pLine = parseOneArg(p, end, &p))
+            || (line = strtol(pLine, NULL, 10)) <= 0 || ++p >= end)
+            return "invalid argument";
+        if (!breakPointPath(NULL, file, path))
+            return "invalid path";
+        if (!(a = compileCommand(p)))
+            return "invalid command";
+
+        for (s = sc->stops; s && (s->line != line || strcmp(s->path, path)); s = s->next);
+        if (!s) {
+            if (!(s = calloc(1, sizeof(BatchStop)))) {
+                free(a);
+                return "not enough memory";
+            }
+            strcpy(s->path, path);
+            s->line = line;
+            s->next = sc->stops;
+            sc->stops = s;
+        }
+        appendAction(&s->actions, a);
     }
-    if (del)
-        lua_pushnil(L);
-    else
-        lua_pushboolean(L, 1);
-    lua_rawseti(L, -2, line);
-
-    if (del) { //check if the path table is empty
-        lua_pushnil(L);
-        if (!lua_next(L, -2)) { //remove the entry from breakpoints table if it's empty
-            lua_pushstring(L, path);
-            lua_pushnil(L);
-            lua_rawset(L, -4);
+    else {
+        if (!(a = compileCommand(p)))
+            return "invalid command";
+        if (g_commands[a->op - STEP].frame) {
+            free(a);
+            return "command needs a stop, use it with 'on' or 'onstop'";
         }
-        else
-            lua_pop(L, 2);
+        appendAction(&sc->commands, a);
     }
-    lua_pop(L, 2);
+    return NULL;
 }
 
 /*
-** Given a table on top of L, it sorts the keys of that table and stores
-** the sorted keys in a new table returned on top of L. Thus L increases by 1.
-** Return the length of the new table.
+** Set the breakpoints and install the actions of a compiled script, then
+** run its plain commands. sc is emptied.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
 */
-int sortKey(lua_State * L)
+static void applyScript(lua_State * L, Script * sc)
 {
-    int i = 1;
-    lua_newtable(L);
-    lua_pushnil(L);
-    while (lua_next(L, -3)) {
-        lua_pushvalue(L, -2);
-        lua_rawseti(L, -4, i++);
-        lua_pop(L, 1);
+    Action * a;
+
+    while (sc->stops) {
+        BatchStop * s = sc->stops;
+        BatchStop * old;
+
+        sc->stops = s->next;
+        toggleBreakPoint(L, s->path, s->line, 0);
+        for (old = g_batch.stops; old && (old->line != s->line || strcmp(old->path, s->path));
+            old = old->next);
+        if (old) {
+            appendAction(&old->actions, s->actions);
+            free(s);
+        }
+        else {
+            s->next = g_batch.stops;
+            g_batch.stops = s;
+        }
     }
+    appendAction(&g_batch.onstop, sc->onstop);
+    sc->onstop = NULL;
 
-    lua_getglobal(L, "table");
-    lua_getfield(L, -1, "sort");
-    lua_pushvalue(L, -3);
-    lua_call(L, 1, 0);
-    lua_pop(L, 1);
-    return i - 1;
+    for (a = sc->commands; a; a = a->next)
+        runAction(L, NULL, a);
+    freeActions(sc->commands);
+    sc->commands = NULL;
 }
 
 /*
-** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
-** unchanged after call.
+** Load a batch script and switch to batch mode, writing to output if given.
+** The whole script is compiled before any of it is applied. Scripts loaded
+** later add their actions to those loaded before.
+** L stays unchanged after call.
 */
-void listBreakPoints(lua_State * L)
+void loadScript(lua_State * L, const char * script, const char * output)
 {
-    int i, n;
-    int top = lua_gettop(L);
-
-    lua_pushliteral(L, "breakpoints");
-    lua_rawget(L, -2);
-    n = sortKey(L);
-
-    printf("Break Points:>>>>>>>>\n");
-    for (i = 1; i <= n; i++) {
-        int j, m;
-        const char * path;
+    FILE * f = fopen(script, "r");
+    Script sc = { NULL, NULL, NULL };
+    char * buf = NULL;
+    size_t size = 0;
+    int lineNo = 0;
+    int got = 0;
+    const char * error = NULL;
+
+    if (!f)
+        luaL_error(L, "cannot open %s", script);
+    while (!error && (got = readLine(f, &buf, &size)) > 0) {
+        lineNo++;
+        error = scriptLine(&sc, buf);
+    }
+    if (got < 0)
+        error = "not enough memory";
+    fclose(f);
+    free(buf);
+    if (error) {
+        freeScript(&sc);
+        fflush(g_out);
+        luaL_error(L, "%s:%d: %s", script, lineNo, error);
+    }
 
-        lua_rawgeti(L, -1, i);
-        path = lua_tostring(L, -1);
-        lua_rawget(L, -3);
-        assert(lua_istable(L, -1));
+    if (output) {
+        FILE * out = fopen(output, "w");
 
-        m = sortKey(L);
-        for (j = 1; j <= m; j++) {
-            lua_rawgeti(L, -1, j);
-            printf("File %s Line %d\n", path, lua_tointeger(L, -1));
-            lua_pop(L, 1);
+        if (!out) {
+            freeScript(&sc);
+            luaL_error(L, "cannot open %s", output);
         }
-        lua_pop(L, 2);
+        if (g_out != stdout)
+            fclose(g_out);
+        g_out = out;
     }
-    lua_pop(L, 2);
-    printf("<<<<<<<<\n");
-    assert(top == lua_gettop(L));
+
+    lua_pushliteral(L, "debugger");
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    applyScript(L, &sc);
+    g_batch.on = 1;
+    lua_sethook(L, hook, LUA_MASKLINE | LUA_MASKCALL | LUA_MASKRET, 0);
+    runAction(L, NULL, &g_runAction);
+    lua_pop(L, 1);
+    fflush(g_out);
+}
+
+/*
+** debugger.runScript(script[, output]) loads a batch script, see g_batch.
+*/
+int apiRunScript(lua_State * L)
+{
+    loadScript(L, luaL_checkstring(L, 1), luaL_optstring(L, 2, NULL));
+    return 0;
 }
 
 #define TIPS \
@@ -764,7 +3088,20 @@ void listBreakPoints(lua_State * L)
 "'run' or 'r': Run until hit a breakpoint.\n"\
 "'setBreakPoint' or 'sb' <file> <line>: Set a breakpoint in file.\n"\
 "'delBreakPoint' or 'db' <file> <line>: Delete a breakpoint in file.\n"\
+"'setFuncBreakPoint' or 'bf' <pattern>: Break at the first line of Lua functions whose source, source:line "\
+"or name in the calling code matches pattern('*' and '?' are wildcards), or named by a global path like "\
+"Shop:buy.\n"\
+"'delFuncBreakPoint' or 'df' <pattern>: Delete a function breakpoint.\n"\
 "'listBreakPoints' or 'lb': List all breakpoints.\n"\
+"'record' or 'rec' [<filter> [arena KB] | off]: Record line events and changed locals of functions whose source "\
+"or name in the calling code matches filter('*' and '?' are wildcards), or show the recording status.\n"\
+"'back' or 'bk': Show the previous recorded event and the locals at that point.\n"\
+"'rewind' or 'rw' <n>: Move n recorded events back. 0 returns to the latest event.\n"\
+"'history' or 'hi' <var-name>: Show all recorded changes of a local variable.\n"\
+"'profile' or 'pf' [on [time] | off | reset]: Count executions, and optionally time, of each line, "\
+"or show the profiling status.\n"\
+"'heatmap' or 'hm' [file | export <lcov-file>]: Show line counts per chunk, the source of a file annotated "\
+"with counts and percentages, or write the counts of the lines that ran in lcov format for editors.\n"\
 "'watch' or 'w' <var-name> [table level]: Watch a single variable from the perspective of the top level call stack."\
 "If the variable is a table, then an optional argument(table level) specifies how many levels the table is expanded.\n"\
 "'listLocals' or 'll' [stack level]: List all local variables of a stack level. Default stack level is 1.\n"\
@@ -772,9 +3109,16 @@ void listBreakPoints(lua_State * L)
 "'printStack' or 'ps': Print call stack.\n"\
 "'exec' or 'e' <script>: Execute script in the context of the debuggee. "\
 "This may have side effects on the debuggee.\n"\
-"'help' or 'h': Show this help."
+"'set' [<option> <value>]: Show or change how values are printed. Options: valueBudget and commandBudget, "\
+"the bytes printed per value and per command; tostring on|off, calling __tostring of tables and userdata; "\
+"timeout, the ms a __tostring call may take.\n"\
+"'help' or 'h': Show this help.\n"\
+"Batch mode: set LUA_DEBUGGER_SCRIPT to a command script, and optionally LUA_DEBUGGER_OUTPUT to an output file, "\
+"or call debugger.runScript(script[, output]). Script lines are commands run when loaded, "\
+"'on <file> <line> <command>' to run a command at a breakpoint, or 'onstop <command>' to run it at other stops. "\
+"Lines starting with '#' are comments."
 
 void showHelp()
 {
-    puts(TIPS);
+    fprintf(g_out, "%s\n", TIPS);
 }